@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <new>
 
 #include <stdlib.h>
@@ -1294,6 +1295,16 @@ ir_value *ast_value::prepareGlobalArray(ir_builder *ir)
     if (!checkArray(*this))
         return nullptr;
 
+    /* the VM checks LOADA and STOREA against the count right before the
+     * elements, it's left out unless the array is indexed that way
+     */
+    if (OPTS_OPTION_U32(OPTION_TARGET) == TARGET_GMQCC_EXT && !(m_flags & AST_FLAG_IS_VARARG)) {
+        m_ir_count = ir->createGlobal("#IMMEDIATE", TYPE_FLOAT);
+        m_ir_count->m_cvq = CV_CONST;
+        m_ir_count->m_context = m_context;
+        (void)!m_ir_count->setFloat(m_count);
+    }
+
     ir_value *v = ir->createGlobal(m_name, vtype);
     if (!v) {
         compile_error(m_context, "ir_builder::createGlobal failed `%s`", m_name);
@@ -1666,6 +1677,42 @@ bool ast_block::codegen(ast_function *func, bool lvalue, ir_value **out)
     return true;
 }
 
+/*
+ * With -target=gmqcc-ext global arrays of single globals or vectors are
+ * indexed with LOADA and STOREA instead of calling their accessors, which
+ * requires their elements to stay in place one after another.
+ */
+static bool ast_array_is_indexed(ast_expression *array, ast_expression *index, bool store)
+{
+    if (OPTS_OPTION_U32(OPTION_TARGET) != TARGET_GMQCC_EXT)
+        return false;
+    if (!ast_istype(array, ast_value) || array->m_vtype != TYPE_ARRAY || index->m_vtype != TYPE_FLOAT)
+        return false;
+
+    auto arr = reinterpret_cast<ast_value*>(array);
+    if (arr->m_flags & AST_FLAG_IS_VARARG || (store && arr->m_cvq == CV_CONST))
+        return false;
+    if (arr->m_ir_values.empty() || arr->m_ir_values[0]->m_store != store_global || !arr->m_ir_count)
+        return false;
+
+    switch (arr->m_next->m_vtype) {
+        case TYPE_FLOAT:
+        case TYPE_VECTOR:
+        case TYPE_STRING:
+        case TYPE_ENTITY:
+        case TYPE_FIELD:
+        case TYPE_FUNCTION:
+            break;
+        default:
+            return false;
+    }
+
+    arr->m_ir_count->m_flags |= IR_FLAG_INDEXED;
+    for (auto &it : arr->m_ir_values)
+        it->m_flags |= IR_FLAG_INDEXED;
+    return true;
+}
+
 bool ast_store::codegen(ast_function *func, bool lvalue, ir_value **out)
 {
     ir_value *left  = nullptr;
@@ -1705,6 +1752,18 @@ bool ast_store::codegen(ast_function *func, bool lvalue, ir_value **out)
         }
 
         auto arr = reinterpret_cast<ast_value*>(ai->m_array);
+        if (ast_array_is_indexed(ai->m_array, ai->m_index, true)) {
+            if (!idx->codegen(func, false, &iridx))
+                return false;
+            if (!m_source->codegen(func, false, &right))
+                return false;
+            if (!ir_block_create_store_to_array(func->m_curblock, m_context, arr->m_ir_values[0], iridx, right))
+                return false;
+            m_outr = right;
+            *out = right;
+            return true;
+        }
+
         if (!ast_istype(ai->m_array, ast_value) || !arr->m_setter) {
             compile_error(m_context, "value has no setter (%s)", arr->m_name);
             return false;
@@ -1956,6 +2015,13 @@ bool ast_binstore::codegen(ast_function *func, bool lvalue, ir_value **out)
         }
 
         arr = (ast_value*)ai->m_array;
+        if (ast_array_is_indexed(ai->m_array, ai->m_index, true)) {
+            if (!ir_block_create_store_to_array(func->m_curblock, m_context, arr->m_ir_values[0], iridx, bin))
+                return false;
+            *out = bin;
+            return true;
+        }
+
         if (!ast_istype(ai->m_array, ast_value) || !arr->m_setter) {
             compile_error(m_context, "value has no setter (%s)", arr->m_name);
             return false;
@@ -2217,6 +2283,19 @@ bool ast_array_index::codegen(ast_function *func, bool lvalue, ir_value **out)
             return false;
         }
 
+        if (ast_array_is_indexed(m_array, m_index, false)) {
+            if (!m_index->codegen(func, false, &iridx))
+                return false;
+            *out = ir_block_create_load_from_array(func->m_curblock, m_context, func->makeLabel("fetch"),
+                                                   arr->m_ir_values[0], iridx);
+            if (!*out)
+                return false;
+            m_outr = *out;
+            (*out)->m_vtype = m_vtype;
+            codegen_output_type(this, *out);
+            return true;
+        }
+
         if (!arr->m_getter) {
             compile_error(m_context, "value has no getter, don't know how to index it");
             return false;
@@ -2772,6 +2851,156 @@ bool ast_breakcont::codegen(ast_function *func, bool lvalue, ir_value **out)
     return true;
 }
 
+/*
+ * Switches on a float with enough constant cases are lowered to a
+ * binary search over the sorted case values.  The leaves compare for
+ * equality, so a NaN still ends up in the default case.  The case
+ * bodies follow in their source order to keep falling through intact.
+ */
+#define AST_SWITCH_TREE_MIN  4
+#define AST_SWITCH_TREE_LEAF 3
+
+struct ast_switch_target {
+    qcfloat_t  value;
+    ir_value  *irvalue;
+    ir_block  *block;
+};
+
+static bool ast_switch_is_constant(const ast_switch *self)
+{
+    size_t count = 0;
+    for (auto &it : self->m_cases) {
+        const ast_value *value = (const ast_value*)it.m_value;
+        if (!value)
+            continue;
+        if (!ast_istype(value, ast_value) || !value->m_hasvalue ||
+            value->m_cvq != CV_CONST || value->m_vtype != TYPE_FLOAT)
+        {
+            return false;
+        }
+        ++count;
+    }
+    return count >= AST_SWITCH_TREE_MIN;
+}
+
+static bool ast_switch_tree(ast_function *func, lex_ctx_t ctx, ir_value *irop,
+                            const std::vector<ast_switch_target> &targets,
+                            size_t lo, size_t hi, ir_block *bdefault)
+{
+    ir_value *cond;
+    ir_block *bless, *bmore;
+    size_t    mid;
+
+    if (hi - lo <= AST_SWITCH_TREE_LEAF) {
+        for (size_t i = lo; i < hi; ++i) {
+            ir_block *bnot = bdefault;
+            cond = ir_block_create_binop(func->m_curblock, ctx, func->makeLabel("switch_eq"),
+                                         INSTR_EQ_F, irop, targets[i].irvalue);
+            if (!cond)
+                return false;
+            if (i + 1 < hi) {
+                bnot = ir_function_create_block(ctx, func->m_ir_func, func->makeLabel("not_case"));
+                if (!bnot)
+                    return false;
+            }
+            if (!ir_block_create_if(func->m_curblock, ctx, cond, targets[i].block, bnot))
+                return false;
+            func->m_curblock = bnot;
+        }
+        return true;
+    }
+
+    mid  = lo + (hi - lo) / 2;
+    cond = ir_block_create_binop(func->m_curblock, ctx, func->makeLabel("switch_lt"),
+                                 INSTR_LT, irop, targets[mid].irvalue);
+    if (!cond)
+        return false;
+    bless = ir_function_create_block(ctx, func->m_ir_func, func->makeLabel("switch_less"));
+    bmore = ir_function_create_block(ctx, func->m_ir_func, func->makeLabel("switch_more"));
+    if (!bless || !bmore)
+        return false;
+    if (!ir_block_create_if(func->m_curblock, ctx, cond, bless, bmore))
+        return false;
+
+    func->m_curblock = bless;
+    if (!ast_switch_tree(func, ctx, irop, targets, lo, mid, bdefault))
+        return false;
+    func->m_curblock = bmore;
+    return ast_switch_tree(func, ctx, irop, targets, mid, hi, bdefault);
+}
+
+static bool ast_switch_codegen_tree(ast_switch *self, ast_function *func, ir_value *irop)
+{
+    std::vector<ast_switch_target> targets;
+    std::vector<ir_block*>          blocks;
+    ir_value *dummy    = nullptr;
+    ir_block *bout     = nullptr;
+    ir_block *bdefault = nullptr;
+    ir_block *bfall    = nullptr;
+    size_t    bout_id;
+
+    bout_id = func->m_ir_func->m_blocks.size();
+    bout = ir_function_create_block(self->m_context, func->m_ir_func, func->makeLabel("after_switch"));
+    if (!bout)
+        return false;
+
+    /* the compares come first, the blocks they jump to are filled in later */
+    ir_block *bswitch = func->m_curblock;
+    for (auto &it : self->m_cases) {
+        ir_value *val;
+        ir_block *bcase = ir_function_create_block(self->m_context, func->m_ir_func, func->makeLabel("case"));
+        if (!bcase)
+            return false;
+        blocks.push_back(bcase);
+        if (!it.m_value) {
+            bdefault = bcase;
+            continue;
+        }
+        if (!it.m_value->codegen(func, false, &val))
+            return false;
+        targets.push_back({ ((ast_value*)it.m_value)->m_constval.vfloat, val, bcase });
+    }
+    func->m_curblock = bswitch;
+
+    /* the first of equal cases is the one taken */
+    std::stable_sort(targets.begin(), targets.end(),
+                     [](const ast_switch_target &a, const ast_switch_target &b) {
+                         return a.value < b.value;
+                     });
+    targets.erase(std::unique(targets.begin(), targets.end(),
+                              [](const ast_switch_target &a, const ast_switch_target &b) {
+                                  return a.value == b.value;
+                              }),
+                  targets.end());
+
+    if (!ast_switch_tree(func, self->m_context, irop, targets, 0, targets.size(),
+                         bdefault ? bdefault : bout))
+    {
+        return false;
+    }
+
+    func->m_breakblocks.push_back(bout);
+    for (size_t i = 0; i < self->m_cases.size(); ++i) {
+        /* Make the previous case-end fall through */
+        if (bfall && !bfall->m_final && !ir_block_create_jump(bfall, self->m_context, blocks[i]))
+            return false;
+        func->m_curblock = blocks[i];
+        if (!self->m_cases[i].m_code->codegen(func, false, &dummy))
+            return false;
+        bfall = func->m_curblock;
+    }
+    func->m_breakblocks.pop_back();
+
+    if (!bfall->m_final && !ir_block_create_jump(bfall, self->m_context, bout))
+        return false;
+    func->m_curblock = bout;
+
+    /* Move 'bout' to the end, it's nicer */
+    algo::shiftback(func->m_ir_func->m_blocks.begin() + bout_id,
+                    func->m_ir_func->m_blocks.end());
+    return true;
+}
+
 bool ast_switch::codegen(ast_function *func, bool lvalue, ir_value **out)
 {
     ast_switch_case *def_case     = nullptr;
@@ -2815,6 +3044,12 @@ bool ast_switch::codegen(ast_function *func, bool lvalue, ir_value **out)
         return false;
     }
 
+    if (OPTS_OPTIMIZATION(OPTIM_SWITCH_TREE) && irop->m_vtype == TYPE_FLOAT &&
+        ast_switch_is_constant(this))
+    {
+        return ast_switch_codegen_tree(this, func, irop);
+    }
+
     bout_id = func->m_ir_func->m_blocks.size();
     bout = ir_function_create_block(m_context, func->m_ir_func, func->makeLabel("after_switch"));
     if (!bout)
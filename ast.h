@@ -232,6 +232,8 @@ struct ast_value : ast_expression
     ir_value *m_ir_v = nullptr;
     std::vector<ir_value*> m_ir_values;
     size_t m_ir_value_count = 0;
+    /* the element count in front of a global array LOADA and STOREA index */
+    ir_value *m_ir_count = nullptr;
 
     /* ONLY for arrays in progs version up to 6 */
     ast_value *m_setter = nullptr;
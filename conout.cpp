@@ -13,6 +13,7 @@ struct con_t {
 };
 
 static con_t console;
+static thread_local con_capture_t *capture = nullptr;
 
 /*
  * Enables color on output if supported.
@@ -33,7 +34,27 @@ static void con_enablecolor(void) {
  * step.
  */
 static int con_write(FILE *handle, const char *fmt, va_list va) {
-    return vfprintf(handle, fmt, va);
+    bool    err = handle == console.handle_err;
+    va_list copy;
+    int     len;
+
+    if (!capture)
+        return vfprintf(handle, fmt, va);
+
+    va_copy(copy, va);
+    len = vsnprintf(nullptr, 0, fmt, copy);
+    va_end(copy);
+    if (len <= 0)
+        return len;
+    if (capture->chunks.empty() || capture->chunks.back().first != err)
+        capture->chunks.emplace_back(err, std::string());
+
+    std::string &text = capture->chunks.back().second;
+    size_t       at   = text.size();
+    text.resize(at + len + 1);
+    vsnprintf(&text[at], len + 1, fmt, va);
+    text.resize(at + len);
+    return len;
 }
 
 /**********************************************************************
@@ -159,6 +180,10 @@ void con_cprintmsg(lex_ctx_t ctx, int lvl, const char *msgtype, const char *msg,
     va_end  (va);
 }
 
+void con_capture(con_capture_t *into) {
+    capture = into;
+}
+
 /* General error interface: TODO seperate as part of the compiler front-end */
 size_t compile_errors   = 0;
 size_t compile_warnings = 0;
@@ -170,9 +195,26 @@ void compile_show_werrors()
     con_cprintmsg(first_werror, LVL_ERROR, "first warning", "was here");
 }
 
+/* the counters of the capturing thread, if any */
+static size_t &compile_count(size_t &global, size_t con_capture_t::*captured)
+{
+    return capture ? capture->*captured : global;
+}
+
+void con_replay(const con_capture_t &from)
+{
+    for (auto &it : from.chunks)
+        fputs(it.second.c_str(), it.first ? console.handle_err : console.handle_out);
+    if (from.Werrors && !compile_Werrors)
+        first_werror = from.first_werror;
+    compile_errors   += from.errors;
+    compile_warnings += from.warnings;
+    compile_Werrors  += from.Werrors;
+}
+
 void vcompile_error(lex_ctx_t ctx, const char *msg, va_list ap)
 {
-    ++compile_errors;
+    ++compile_count(compile_errors, &con_capture_t::errors);
     con_cvprintmsg(ctx, LVL_ERROR, "error", msg, ap);
 }
 
@@ -197,15 +239,15 @@ bool GMQCC_WARN vcompile_warning(lex_ctx_t ctx, int warntype, const char *fmt, v
     warn_name[1] = 'W';
     (void)util_strtononcmd(opts_warn_list[warntype].name, warn_name+2, sizeof(warn_name)-2);
 
-    ++compile_warnings;
+    ++compile_count(compile_warnings, &con_capture_t::warnings);
     if (OPTS_WERROR(warntype)) {
-        if (!compile_Werrors)
-            first_werror = ctx;
-        ++compile_Werrors;
+        if (!compile_count(compile_Werrors, &con_capture_t::Werrors))
+            (capture ? capture->first_werror : first_werror) = ctx;
+        ++compile_count(compile_Werrors, &con_capture_t::Werrors);
         msgtype = "Werror";
         if (OPTS_FLAG(BAIL_ON_WERROR)) {
             msgtype = "error";
-            ++compile_errors;
+            ++compile_count(compile_errors, &con_capture_t::errors);
         }
         lvl = LVL_ERROR;
     }
@@ -4,6 +4,13 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <map>
+
+#ifndef _WIN32
+#   include <dlfcn.h>
+#endif
+
 #include "gmqcc.h"
 
 static void loaderror(const char *fmt, ...)
@@ -23,15 +30,40 @@ static void qcvmerror(qc_program_t *prog, const char *fmt, ...)
     prog->vmerror++;
 
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    vfprintf(prog->out, fmt, ap);
     va_end(ap);
-    putchar('\n');
+    fputc('\n', prog->out);
+}
+
+/*
+ * Entities live in chunks of QCVM_ENTITY_CHUNK entities which never move
+ * once allocated, so growing does not copy the existing entities and
+ * their addresses stay valid.
+ */
+static qcint_t *prog_entity(qc_program_t *prog, qcint_t e) {
+    return prog->entitychunks[e >> QCVM_ENTITY_CHUNK_BITS].get() +
+           (e & (QCVM_ENTITY_CHUNK - 1)) * prog->entityfields;
+}
+
+static void prog_entity_chunk_alloc(qc_program_t *prog) {
+    prog->entitychunks.emplace_back(new qcint_t[QCVM_ENTITY_CHUNK * prog->entityfields]());
+    prog->entitypages.emplace_back();
+}
+
+/*
+ * Entity chunks which get written to no longer match the snapshot page
+ * they were taken from or restored to.
+ */
+static void prog_entity_written(qc_program_t *prog, qcint_t e) {
+    prog->entitypages[e >> QCVM_ENTITY_CHUNK_BITS].reset();
 }
 
 qc_program::qc_program(const char *name, uint16_t crc, size_t entfields)
     : filename(name)
     , crc16(crc)
     , entityfields(entfields)
+    , out(stdout)
+    , nativehandle(nullptr)
 {}
 
 qc_program_t* prog_load(const char *filename, bool skipversion)
@@ -103,6 +135,7 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
     /* profile counters */
     prog->profile.resize(prog->code.size());
     memset(&prog->profile[0], 0, sizeof(prog->profile[0]) * prog->profile.size());
+    prog->profile_jumps.assign(prog->code.size(), 0);
 
     /* Add tempstring area */
     prog->tempstring_start = prog->strings.size();
@@ -112,9 +145,7 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
 
     /* spawn the world entity */
     prog->entitypool.emplace_back(true);
-    prog->entitydata.resize(prog->entityfields);
-    if (prog->entitydata.size())
-        memset(prog->entitydata.data(), 0, sizeof(prog->entitydata[0]) * prog->entityfields);
+    prog_entity_chunk_alloc(prog);
     prog->entities = 1;
 
     /* cache some globals and fields from names */
@@ -147,6 +178,8 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
     if (has_self && has_time && has_think && has_nextthink && has_frame)
         prog->supports_state = true;
 
+    prog->verified = prog_verify(prog);
+
     return prog;
 
 error:
@@ -158,9 +191,500 @@ error:
 
 void prog_delete(qc_program_t *prog)
 {
+#ifndef _WIN32
+    if (prog->nativehandle)
+        dlclose(prog->nativehandle);
+#endif
     delete prog;
 }
 
+/***********************************************************************
+ * Native code
+ *
+ * Functions compiled to C with gmqcc's -emit-c work on the globals and
+ * entities of the program directly and call back in here for builtins,
+ * strings and errors.
+ */
+
+typedef int static_assert_qcrt_int  [(sizeof(qcrt_int_t) == sizeof(qcint_t)) ? 1 : -1];
+typedef int static_assert_qcrt_parms[(QCRT_OFS_RETURN == OFS_RETURN && QCRT_OFS_PARM0 == OFS_PARM0) ? 1 : -1];
+
+/* has to be called before control passes into native code */
+static void prog_native_sync(qc_program_t *prog) {
+    size_t i;
+    prog->nativechunks.resize(prog->entitychunks.size());
+    for (i = 0; i < prog->entitychunks.size(); ++i)
+        prog->nativechunks[i] = prog->entitychunks[i].get();
+    prog->rt.chunks           = prog->nativechunks.data();
+    prog->rt.entities         = prog->entities;
+    prog->rt.entityfields     = prog->entityfields;
+    prog->rt.allowworldwrites = prog->allowworldwrites;
+}
+
+static void prog_native_error(qcrt_t *rt, const char *fmt, ...) {
+    qc_program_t *prog = (qc_program_t*)rt->host;
+    va_list ap;
+
+    prog->vmerror++;
+
+    fprintf(prog->out, "`%s` ", prog->filename.c_str());
+    va_start(ap, fmt);
+    vfprintf(prog->out, fmt, ap);
+    va_end(ap);
+    fputc('\n', prog->out);
+}
+
+static int prog_native_call(qcrt_t *rt, qcint_t fnum, int argc) {
+    qc_program_t *prog = (qc_program_t*)rt->host;
+    prog_section_function_t *newf;
+    int error;
+
+    if (fnum <= 0 || fnum >= (qcint_t)prog->functions.size()) {
+        qcvmerror(prog, "CALL outside the program in `%s`", prog->filename.c_str());
+        return 1;
+    }
+
+    newf = &prog->functions[fnum];
+    newf->profile++;
+
+    if (prog->natives[fnum])
+        return prog->natives[fnum](rt);
+
+    if (newf->entry >= 0) {
+        qcvmerror(prog, "function `%s` in `%s` has no native code",
+                  prog_getstring(prog, newf->name), prog->filename.c_str());
+        return 1;
+    }
+
+    prog->argc = argc;
+    if (-newf->entry < (qcint_t)prog->builtins_count && prog->builtins[-newf->entry])
+        prog->builtins[-newf->entry](prog);
+    else
+        qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                  -newf->entry, prog->filename.c_str());
+
+    /* builtins may spawn entities */
+    error = prog->vmerror != 0;
+    prog_native_sync(prog);
+    return error;
+}
+
+static const char *prog_native_string(qcrt_t *rt, qcint_t str) {
+    return prog_getstring((qc_program_t*)rt->host, str);
+}
+
+static int prog_native_state(qcrt_t *rt, qcfloat_t frame, qcint_t think) {
+    qc_program_t *prog = (qc_program_t*)rt->host;
+    qcint_t *ed;
+
+    if (!prog->supports_state) {
+        qcvmerror(prog, "`%s` tried to execute a STATE operation but misses its defs!", prog->filename.c_str());
+        return 1;
+    }
+    ed = (qcint_t*)prog_getedict(prog, prog->globals[prog->cached_globals.self]);
+    ed[prog->cached_fields.think] = think;
+    *(qcfloat_t*)&ed[prog->cached_fields.frame] = frame;
+    *(qcfloat_t*)&ed[prog->cached_fields.nextthink] =
+        *(qcfloat_t*)&prog->globals[prog->cached_globals.time] + 0.1;
+    return prog->vmerror != 0;
+}
+
+/*
+ * Loads a shared object built from the C code gmqcc emitted for this
+ * program, which has to match it, and executes its functions natively
+ * from then on.
+ */
+bool prog_load_native(qc_program_t *prog, const char *filename) {
+#ifndef _WIN32
+    const qcrt_module_t *(*module)(void);
+    const qcrt_module_t *mod;
+    size_t i;
+
+    if (!(prog->nativehandle = dlopen(filename, RTLD_NOW | RTLD_LOCAL))) {
+        fprintf(stderr, "failed to load native code: %s\n", dlerror());
+        return false;
+    }
+    *(void**)&module = dlsym(prog->nativehandle, "qcrt_module");
+    if (!module) {
+        fprintf(stderr, "`%s` contains no qcrt_module\n", filename);
+        return false;
+    }
+
+    mod = module();
+    if (mod->version != QCRT_VERSION) {
+        fprintf(stderr, "`%s` was built for runtime version %i, expected %i\n", filename, mod->version, QCRT_VERSION);
+        return false;
+    }
+    if (mod->crc        != prog->crc16                     ||
+        mod->globals    >  (qcint_t)prog->globals.size()   ||
+        mod->functions  != (qcint_t)prog->functions.size() ||
+        mod->statements != (qcint_t)prog->code.size())
+    {
+        fprintf(stderr, "`%s` was not built from `%s`\n", filename, prog->filename.c_str());
+        return false;
+    }
+
+    prog->natives.assign(prog->functions.size(), nullptr);
+    for (i = 0; i < mod->count; ++i) {
+        const qcrt_entry_t &entry = mod->entries[i];
+        if (entry.function <= 0 || entry.function >= (qcint_t)prog->functions.size()) {
+            fprintf(stderr, "`%s` contains an invalid function %i\n", filename, entry.function);
+            return false;
+        }
+        prog->natives[entry.function] = entry.native;
+    }
+
+    prog->rt.globals = prog->globals.data();
+    prog->rt.call    = prog_native_call;
+    prog->rt.string  = prog_native_string;
+    prog->rt.state   = prog_native_state;
+    prog->rt.error   = prog_native_error;
+    prog->rt.host    = prog;
+    return true;
+#else
+    (void)prog;
+    fprintf(stderr, "cannot load native code `%s` on this platform\n", filename);
+    return false;
+#endif
+}
+
+/***********************************************************************
+ * Verifier
+ */
+
+/*
+ * Fills in how many globals each operand of an instruction covers, 0 for
+ * operands which aren't globals, and which operand gets written to, or
+ * -1.  Returns false for anything that isn't a valid instruction.
+ */
+static bool prog_instr_operands(uint16_t opcode, int size[3], int *written) {
+    size[0] = size[1] = size[2] = 0;
+    *written = -1;
+    switch (opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+            size[0] = 3;
+            return true;
+
+        case INSTR_MUL_F:  case INSTR_DIV_F:  case INSTR_ADD_F:  case INSTR_SUB_F:
+        case INSTR_EQ_F:   case INSTR_EQ_S:   case INSTR_EQ_E:   case INSTR_EQ_FNC:
+        case INSTR_NE_F:   case INSTR_NE_S:   case INSTR_NE_E:   case INSTR_NE_FNC:
+        case INSTR_LE:     case INSTR_GE:     case INSTR_LT:     case INSTR_GT:
+        case INSTR_AND:    case INSTR_OR:     case INSTR_BITAND: case INSTR_BITOR:
+        case INSTR_BITXOR: case INSTR_LOADA_F:
+        case INSTR_LOAD_F: case INSTR_LOAD_S: case INSTR_LOAD_ENT:
+        case INSTR_LOAD_FLD: case INSTR_LOAD_FNC: case INSTR_ADDRESS:
+            size[0] = size[1] = size[2] = 1;
+            *written = 2;
+            return true;
+        case INSTR_MUL_V:
+        case INSTR_EQ_V:
+        case INSTR_NE_V:
+            size[0] = size[1] = 3; size[2] = 1;
+            *written = 2;
+            return true;
+        case INSTR_MUL_FV:
+            size[0] = 1; size[1] = size[2] = 3;
+            *written = 2;
+            return true;
+        case INSTR_MUL_VF:
+            size[0] = size[2] = 3; size[1] = 1;
+            *written = 2;
+            return true;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+        case INSTR_BITAND_V: case INSTR_BITOR_V: case INSTR_BITXOR_V:
+        case INSTR_CROSS:
+            size[0] = size[1] = size[2] = 3;
+            *written = 2;
+            return true;
+        case INSTR_BITAND_VF: case INSTR_BITOR_VF: case INSTR_BITXOR_VF:
+            size[0] = size[2] = 3; size[1] = 1;
+            *written = 2;
+            return true;
+        case INSTR_LOADA_V:
+            size[0] = size[2] = 3; size[1] = 1;
+            *written = 2;
+            return true;
+        case INSTR_LOAD_V:
+            size[0] = size[1] = 1; size[2] = 3;
+            *written = 2;
+            return true;
+
+        case INSTR_STORE_F: case INSTR_STORE_S: case INSTR_STORE_ENT:
+        case INSTR_STORE_FLD: case INSTR_STORE_FNC:
+            size[0] = size[1] = 1;
+            *written = 1;
+            return true;
+        case INSTR_STORE_V:
+            size[0] = size[1] = 3;
+            *written = 1;
+            return true;
+        case INSTR_STOREP_F: case INSTR_STOREP_S: case INSTR_STOREP_ENT:
+        case INSTR_STOREP_FLD: case INSTR_STOREP_FNC:
+        case INSTR_STATE:
+            size[0] = size[1] = 1;
+            return true;
+        case INSTR_STOREP_V:
+            size[0] = 3; size[1] = 1;
+            return true;
+        /* the globals after o2 they write to are only known at runtime */
+        case INSTR_STOREA_F:
+            size[0] = size[1] = size[2] = 1;
+            return true;
+        case INSTR_STOREA_V:
+            size[0] = size[1] = 3; size[2] = 1;
+            return true;
+
+        case INSTR_NOT_F: case INSTR_NOT_S: case INSTR_NOT_ENT: case INSTR_NOT_FNC:
+            size[0] = size[2] = 1;
+            *written = 2;
+            return true;
+        case INSTR_NOT_V:
+            size[0] = 3; size[2] = 1;
+            *written = 2;
+            return true;
+
+        case INSTR_IF:
+        case INSTR_IFNOT:
+        case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+        case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+        case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+        case INSTR_TAILCALL:
+            size[0] = 1;
+            return true;
+        case INSTR_GOTO:
+            return true;
+    }
+    return false;
+}
+
+/*
+ * A function's entry, locals and parameters have to fit the program.
+ */
+static bool prog_function_sane(qc_program_t *prog, const prog_section_function_t &func) {
+    size_t params = 0;
+    if ((size_t)func.entry >= prog->code.size() || func.nargs > 8 ||
+        (size_t)func.firstlocal + func.locals > prog->globals.size())
+        return false;
+    for (int p = 0; p < func.nargs; ++p) {
+        if (func.argsize[p] > 3)
+            return false;
+        params += func.argsize[p];
+    }
+    return params <= func.locals;
+}
+
+/*
+ * The number of globals the array LOADA and STOREA index at base spans,
+ * or -1 when its element count in front of it is no valid count of
+ * elements of the width fitting the globals.
+ */
+static int64_t prog_array_span(qc_program_t *prog, size_t base, size_t width) {
+    size_t    globals = prog->globals.size();
+    qcfloat_t count;
+    if (base < 1 || base >= globals)
+        return -1;
+    count = ((qcany_t*)&prog->globals[base - 1])->_float;
+    if (!(count >= 0) || count != (qcfloat_t)(int64_t)count || base + (size_t)count * width > globals)
+        return -1;
+    return (int64_t)count * width;
+}
+
+/*
+ * Marks the globals a program can write to: the written operands, the
+ * locals parameters get copied to, the return value and the arrays
+ * indexed stores reach.  Anything out of range is left to the callers to
+ * complain about.
+ */
+static void prog_written_globals(qc_program_t *prog, std::vector<bool> &written) {
+    size_t globals = prog->globals.size();
+    size_t indexed = globals;
+    int    size[3], w;
+
+    written.assign(globals, false);
+    for (size_t i = OFS_RETURN; i < OFS_PARM0 && i < globals; ++i)
+        written[i] = true;
+    for (size_t i = 1; i < prog->functions.size(); ++i) {
+        const prog_section_function_t &func = prog->functions[i];
+        if (func.entry < 0 || !prog_function_sane(prog, func))
+            continue;
+        size_t at = func.firstlocal;
+        for (int p = 0; p < func.nargs; ++p)
+            for (size_t k = 0; k < func.argsize[p]; ++k)
+                written[at++] = true;
+    }
+    for (auto &it : prog->code) {
+        /* anything from o2 on when the array's count is broken */
+        if (it.opcode == INSTR_STOREA_F || it.opcode == INSTR_STOREA_V) {
+            int64_t span = prog_array_span(prog, it.o2.u1, it.opcode == INSTR_STOREA_V ? 3 : 1);
+            if (span < 0)
+                indexed = std::min(indexed, (size_t)it.o2.u1);
+            for (int64_t k = 0; k < span; ++k)
+                written[it.o2.u1 + k] = true;
+            continue;
+        }
+        if (!prog_instr_operands(it.opcode, size, &w) || w < 0)
+            continue;
+        for (int k = 0; k < size[w]; ++k)
+            if ((size_t)(&it.o1)[w].u1 + k < globals)
+                written[(&it.o1)[w].u1 + k] = true;
+    }
+    for (size_t i = indexed; i < globals; ++i)
+        written[i] = true;
+}
+
+/*
+ * Checks that every global a statement uses lies within the globals, that
+ * jumps stay within their function, that the code can't run off its end,
+ * and that calls through globals which are never written to reach a
+ * function.  The field operand of every LOAD and ADDRESS has to be such a
+ * constant global holding a valid field offset, so the interpreter can
+ * skip the field bound checks for programs passing this.  This is linear
+ * in the size of the program apart from sorting the function entries.
+ * Without reject it stops at the first problem, with it every problem is
+ * passed to it along with its statement, or -1.
+ */
+typedef void (*prog_reject_t)(void *user, qcint_t statement, const char *reason);
+
+static bool prog_check(qc_program_t *prog, prog_reject_t reject, void *user) {
+    std::vector<bool> written;
+    std::vector<bool> broken; /* statements with operands out of range */
+    std::vector<std::pair<qcint_t, size_t>> entries;
+    size_t globals = prog->globals.size();
+    size_t count   = prog->code.size();
+    size_t i, f;
+    int    size[3], w;
+    bool   ok = true;
+    char   buffer[256];
+
+#define REJECT(STMT, ...) do {                                  \
+        if (!reject)                                            \
+            return false;                                       \
+        util_snprintf(buffer, sizeof(buffer), __VA_ARGS__);     \
+        reject(user, (qcint_t)(STMT), buffer);                  \
+        ok = false;                                             \
+    } while (0)
+
+    if (!count) {
+        REJECT(-1, "the program has no code");
+        return false;
+    }
+
+    /* the function table */
+    for (i = 1; i < prog->functions.size(); ++i) {
+        const prog_section_function_t &func = prog->functions[i];
+        if (func.entry < 0)
+            continue;
+        if (!prog_function_sane(prog, func)) {
+            REJECT(-1, "function %zu has an invalid entry, locals or parameters", i);
+            continue;
+        }
+        entries.emplace_back(func.entry, i);
+    }
+
+    /* operands */
+    broken.assign(count, false);
+    for (i = 0; i < count; ++i) {
+        const prog_section_statement_t &it = prog->code[i];
+        if (!prog_instr_operands(it.opcode, size, &w)) {
+            REJECT(i, "illegal instruction %u", (unsigned)it.opcode);
+            broken[i] = true;
+            continue;
+        }
+        for (int o = 0; o < 3; ++o) {
+            if (size[o] && (size_t)(&it.o1)[o].u1 + size[o] > globals) {
+                REJECT(i, "operand %i is out of range", o+1);
+                broken[i] = true;
+            }
+        }
+    }
+    prog_written_globals(prog, written);
+
+    /* jumps, calls and field operands */
+    std::sort(entries.begin(), entries.end());
+    for (f = 0, i = 0; i < count; ++i) {
+        const prog_section_statement_t &st = prog->code[i];
+        size_t  begin, end;
+        int64_t target;
+
+        while (f+1 < entries.size() && (size_t)entries[f+1].first <= i)
+            ++f;
+        begin = entries.empty() || (size_t)entries[f].first > i ? 0 : entries[f].first;
+        end   = f+1 < entries.size() ? entries[f+1].first : count;
+        if (broken[i])
+            continue;
+
+        switch (st.opcode) {
+            case INSTR_IF:
+            case INSTR_IFNOT:
+                target = (int64_t)i + st.o2.s1;
+                break;
+            case INSTR_GOTO:
+                target = (int64_t)i + st.o1.s1;
+                break;
+            case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+            case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+            case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+            case INSTR_TAILCALL:
+                if (st.opcode == INSTR_TAILCALL && st.o2.u1 > 8)
+                    REJECT(i, "tail call with %u parameters", st.o2.u1);
+                if (!written[st.o1.u1]) {
+                    qcint_t fn = prog->globals[st.o1.u1];
+                    if (fn <= 0 || (size_t)fn >= prog->functions.size())
+                        REJECT(i, "calls invalid function %i", (int)fn);
+                }
+                continue;
+            /* the element count of an indexed array has to stay put */
+            case INSTR_LOADA_F: case INSTR_LOADA_V:
+                if (prog_array_span(prog, st.o1.u1, st.opcode == INSTR_LOADA_V ? 3 : 1) < 0)
+                    REJECT(i, "indexes global %u without a valid element count in front of it", st.o1.u1);
+                else if (written[st.o1.u1 - 1])
+                    REJECT(i, "indexes global %u whose element count is written to", st.o1.u1);
+                continue;
+            case INSTR_STOREA_F: case INSTR_STOREA_V:
+                if (prog_array_span(prog, st.o2.u1, st.opcode == INSTR_STOREA_V ? 3 : 1) < 0)
+                    REJECT(i, "indexes global %u without a valid element count in front of it", st.o2.u1);
+                else if (written[st.o2.u1 - 1])
+                    REJECT(i, "indexes global %u whose element count is written to", st.o2.u1);
+                continue;
+            case INSTR_LOAD_F: case INSTR_LOAD_S: case INSTR_LOAD_ENT:
+            case INSTR_LOAD_FLD: case INSTR_LOAD_FNC: case INSTR_ADDRESS:
+            case INSTR_LOAD_V:
+            {
+                qcint_t field = prog->globals[st.o2.u1];
+                qcint_t width = (st.opcode == INSTR_LOAD_V) ? 3 : 1;
+                if (written[st.o2.u1])
+                    REJECT(i, "the field operand (global %u) is not constant", st.o2.u1);
+                else if (field < 0 || (size_t)(field + width) > prog->entityfields)
+                    REJECT(i, "the field operand (global %u) holds the invalid field %i", st.o2.u1, (int)field);
+                continue;
+            }
+            default:
+                continue;
+        }
+        if (target < (int64_t)begin || target >= (int64_t)end)
+            REJECT(i, "jumps to statement %lli outside of the function", (long long)target);
+    }
+
+    /* the last statement has to leave */
+    switch (prog->code.back().opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+        case INSTR_TAILCALL:
+        case INSTR_GOTO:
+            break;
+        default:
+            REJECT(count - 1, "execution can run past the last statement");
+    }
+#undef REJECT
+    return ok;
+}
+
+bool prog_verify(qc_program_t *prog) {
+    return prog_check(prog, nullptr, nullptr);
+}
+
 /***********************************************************************
  * VM code
  */
@@ -173,6 +697,22 @@ const char* prog_getstring(qc_program_t *prog, qcint_t str) {
     return &prog->strings[0] + str;
 }
 
+/*
+ * The globals LOADA and STOREA access at a float index into the array at
+ * base, or nullptr after raising an error when the index lies outside of
+ * the array, whose element count is the float right before it.
+ */
+static qcany_t *prog_global_index(qc_program_t *prog, qcint_t base, qcfloat_t index, qcint_t width) {
+    qcint_t   globals = (qcint_t)prog->globals.size();
+    qcfloat_t count   = (base > 0 && base < globals) ? ((qcany_t*)&prog->globals[base - 1])->_float : 0;
+    if (!(index >= 0) || index >= count || index >= globals || base + (qcint_t)index * width + width > globals) {
+        qcvmerror(prog, "`%s` accessed index %g of the %g element array at global %i",
+                  prog->filename.c_str(), index, count, (int)base);
+        return nullptr;
+    }
+    return (qcany_t*)(&prog->globals[0] + base + (qcint_t)index * width);
+}
+
 prog_section_def_t* prog_entfield(qc_program_t *prog, qcint_t off) {
     for (auto &it : prog->fields)
         if (it.offset == off)
@@ -194,26 +734,27 @@ qcany_t* prog_getedict(qc_program_t *prog, qcint_t e) {
         fprintf(stderr, "Accessing out of bounds edict %i\n", (int)e);
         e = 0;
     }
-    return (qcany_t*)&prog->entitydata[prog->entityfields * e];
+    /* the caller may write to it */
+    prog_entity_written(prog, e);
+    return (qcany_t*)prog_entity(prog, e);
 }
 
 static qcint_t prog_spawn_entity(qc_program_t *prog) {
-    char  *data;
     qcint_t  e;
     for (e = 0; e < (qcint_t)prog->entitypool.size(); ++e) {
-        if (!prog->entitypool[e]) {
-            data = (char*)&prog->entitydata[prog->entityfields * e];
-            memset(data, 0, prog->entityfields * sizeof(qcint_t));
-            return e;
-        }
+        if (!prog->entitypool[e])
+            break;
     }
-    prog->entitypool.emplace_back(true);
-    prog->entities++;
-    size_t sz = prog->entitydata.size();
-    prog->entitydata.resize(sz + prog->entityfields);
-    data = (char*)&prog->entitydata[sz];
-    memset(data, 0, sz * sizeof(qcint_t));
-
+    if (e == (qcint_t)prog->entitypool.size()) {
+        prog->entitypool.emplace_back(true);
+        prog->entities++;
+        if ((size_t)e == prog->entitychunks.size() * QCVM_ENTITY_CHUNK)
+            prog_entity_chunk_alloc(prog);
+    } else {
+        prog->entitypool[e] = true;
+    }
+    memset(prog_entity(prog, e), 0, prog->entityfields * sizeof(qcint_t));
+    prog_entity_written(prog, e);
     return e;
 }
 
@@ -258,47 +799,151 @@ qcint_t prog_tempstring(qc_program_t *prog, const char *str) {
     return at;
 }
 
-static size_t print_escaped_string(const char *str, size_t maxlen) {
+/*
+ * Snapshots copy the globals page by page, the entities chunk by chunk
+ * and the tempstring area.  A page which still matches the snapshot page
+ * it was last copied from or to is shared instead of copied.  Entity
+ * chunks are only written by STOREP, STATE, spawning and through
+ * prog_getedict, and lose their page there, globals are compared since
+ * every instruction writes to them.  Neither function may be called while
+ * the program executes.
+ */
+static bool prog_page_matches(const qc_page_t &page, const qcint_t *data, size_t count) {
+    return page && page->size() == count &&
+           !memcmp(page->data(), data, count * sizeof(qcint_t));
+}
+
+static void prog_snapshot_pages(std::vector<qc_page_t> &pages,
+                                std::vector<qc_page_t> &known,
+                                const std::vector<qcint_t> &data)
+{
+    size_t i;
+    known.resize((data.size() + QCVM_PAGE_SIZE - 1) >> QCVM_PAGE_BITS);
+    for (i = 0; i < data.size(); i += QCVM_PAGE_SIZE) {
+        qc_page_t &page = known[i >> QCVM_PAGE_BITS];
+        size_t count = data.size() - i;
+        if (count > QCVM_PAGE_SIZE)
+            count = QCVM_PAGE_SIZE;
+        if (!prog_page_matches(page, &data[i], count))
+            page = std::make_shared<std::vector<qcint_t>>(data.begin() + i, data.begin() + i + count);
+        pages.push_back(page);
+    }
+}
+
+static void prog_restore_pages(const std::vector<qc_page_t> &pages,
+                               std::vector<qc_page_t> &known,
+                               std::vector<qcint_t> &data)
+{
+    size_t i;
+    known.resize(pages.size());
+    for (i = 0; i < pages.size(); ++i) {
+        const qc_page_t &page = pages[i];
+        qcint_t *at = &data[i << QCVM_PAGE_BITS];
+        if (known[i] == page && prog_page_matches(page, at, page->size()))
+            continue;
+        memcpy(at, page->data(), page->size() * sizeof(qcint_t));
+        known[i] = page;
+    }
+}
+
+qc_snapshot_t *prog_snapshot(qc_program_t *prog) {
+    qc_snapshot_t *snap = new qc_snapshot_t;
+    size_t chunk = QCVM_ENTITY_CHUNK * prog->entityfields;
+    size_t i;
+
+    snap->strings_count = prog->strings.size();
+    snap->tempstring_at = prog->tempstring_at;
+    snap->entities      = prog->entities;
+    snap->entitypool    = prog->entitypool;
+    snap->strings.assign(prog->strings.begin() + prog->tempstring_start, prog->strings.end());
+
+    prog_snapshot_pages(snap->globals, prog->globalpages, prog->globals);
+    for (i = 0; i < prog->entitychunks.size(); ++i) {
+        qc_page_t &page = prog->entitypages[i];
+        if (!page) {
+            const qcint_t *data = prog->entitychunks[i].get();
+            page = std::make_shared<std::vector<qcint_t>>(data, data + chunk);
+        }
+        snap->entitychunks.push_back(page);
+    }
+    return snap;
+}
+
+void prog_restore(qc_program_t *prog, const qc_snapshot_t *snap) {
+    size_t chunk = QCVM_ENTITY_CHUNK * prog->entityfields;
+    size_t i;
+
+    prog->strings.resize(snap->strings_count);
+    memcpy(&prog->strings[0] + prog->tempstring_start, snap->strings.data(), snap->strings.size());
+
+    prog->tempstring_at = snap->tempstring_at;
+    prog->entities      = snap->entities;
+    prog->entitypool    = snap->entitypool;
+
+    prog_restore_pages(snap->globals, prog->globalpages, prog->globals);
+
+    /* chunks beyond the snapshot are dropped, missing ones allocated */
+    if (prog->entitychunks.size() > snap->entitychunks.size()) {
+        prog->entitychunks.resize(snap->entitychunks.size());
+        prog->entitypages.resize(snap->entitychunks.size());
+    }
+    while (prog->entitychunks.size() < snap->entitychunks.size())
+        prog_entity_chunk_alloc(prog);
+    for (i = 0; i < snap->entitychunks.size(); ++i) {
+        const qc_page_t &page = snap->entitychunks[i];
+        if (prog->entitypages[i] == page)
+            continue;
+        memcpy(prog->entitychunks[i].get(), page->data(), chunk * sizeof(qcint_t));
+        prog->entitypages[i] = page;
+    }
+}
+
+void prog_snapshot_delete(qc_snapshot_t *snap) {
+    delete snap;
+}
+
+static size_t print_escaped_string(FILE *out, const char *str, size_t maxlen) {
     size_t len = 2;
-    putchar('"');
+    fputc('"', out);
     --maxlen; /* because we're lazy and have escape sequences */
     while (*str) {
         if (len >= maxlen) {
-            putchar('.');
-            putchar('.');
-            putchar('.');
+            fputc('.', out);
+            fputc('.', out);
+            fputc('.', out);
             len += 3;
             break;
         }
         switch (*str) {
-            case '\a': len += 2; putchar('\\'); putchar('a'); break;
-            case '\b': len += 2; putchar('\\'); putchar('b'); break;
-            case '\r': len += 2; putchar('\\'); putchar('r'); break;
-            case '\n': len += 2; putchar('\\'); putchar('n'); break;
-            case '\t': len += 2; putchar('\\'); putchar('t'); break;
-            case '\f': len += 2; putchar('\\'); putchar('f'); break;
-            case '\v': len += 2; putchar('\\'); putchar('v'); break;
-            case '\\': len += 2; putchar('\\'); putchar('\\'); break;
-            case '"':  len += 2; putchar('\\'); putchar('"'); break;
+            case '\a': len += 2; fputc('\\', out); fputc('a', out); break;
+            case '\b': len += 2; fputc('\\', out); fputc('b', out); break;
+            case '\r': len += 2; fputc('\\', out); fputc('r', out); break;
+            case '\n': len += 2; fputc('\\', out); fputc('n', out); break;
+            case '\t': len += 2; fputc('\\', out); fputc('t', out); break;
+            case '\f': len += 2; fputc('\\', out); fputc('f', out); break;
+            case '\v': len += 2; fputc('\\', out); fputc('v', out); break;
+            case '\\': len += 2; fputc('\\', out); fputc('\\', out); break;
+            case '"':  len += 2; fputc('\\', out); fputc('"', out); break;
             default:
                 ++len;
-                putchar(*str);
+                fputc(*str, out);
                 break;
         }
         ++str;
     }
-    putchar('"');
+    fputc('"', out);
     return len;
 }
 
 static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype) {
-    static char spaces[28+1] = "                            ";
+    const int  width = 28;
+    FILE      *out   = prog->out;
     prog_section_def_t *def;
     qcany_t    *value;
     int       len;
 
     if (!glob) {
-        if ((len = printf("<null>,")) == -1)
+        if ((len = fprintf(out, "<null>,")) == -1)
             len = 0;
 
         goto done;
@@ -307,13 +952,13 @@ static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype)
     def = prog_getdef(prog, glob);
     value = (qcany_t*)(&prog->globals[glob]);
 
-    len = printf("[@%u] ", glob);
+    len = fprintf(out, "[@%u] ", glob);
     if (def) {
         const char *name = prog_getstring(prog, def->name);
         if (name[0] == '#')
-            len += printf("$");
+            len += fprintf(out, "$");
         else
-            len += printf("%s ", name);
+            len += fprintf(out, "%s ", name);
         vtype = def->type & DEF_TYPEMASK;
     }
 
@@ -323,61 +968,61 @@ static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype)
         case TYPE_FIELD:
         case TYPE_FUNCTION:
         case TYPE_POINTER:
-            len += printf("(%i),", value->_int);
+            len += fprintf(out, "(%i),", value->_int);
             break;
         case TYPE_VECTOR:
-            len += printf("'%g %g %g',", value->vector[0],
+            len += fprintf(out, "'%g %g %g',", value->vector[0],
                                          value->vector[1],
                                          value->vector[2]);
             break;
         case TYPE_STRING:
             if (value->string)
-                len += print_escaped_string(prog_getstring(prog, value->string), sizeof(spaces)-len-5);
+                len += print_escaped_string(out, prog_getstring(prog, value->string), width+1-len-5);
             else
-                len += printf("(null)");
-            len += printf(",");
-            /* len += printf("\"%s\",", prog_getstring(prog, value->string)); */
+                len += fprintf(out, "(null)");
+            len += fprintf(out, ",");
+            /* len += fprintf(out, "\"%s\",", prog_getstring(prog, value->string)); */
             break;
         case TYPE_FLOAT:
         default:
-            len += printf("%g,", value->_float);
+            len += fprintf(out, "%g,", value->_float);
             break;
     }
 done:
-    if (len < (int)sizeof(spaces)-1) {
-        spaces[sizeof(spaces)-1-len] = 0;
-        fputs(spaces, stdout);
-        spaces[sizeof(spaces)-1-len] = ' ';
-    }
+    if (len < width)
+        fprintf(out, "%*s", width-len, "");
 }
 
 static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *st) {
     if (st->opcode >= VINSTR_END) {
-        printf("<illegal instruction %d>\n", st->opcode);
+        fprintf(prog->out, "<illegal instruction %d>\n", st->opcode);
         return;
     }
     if ((prog->xflags & VMXF_TRACE) && !prog->function_stack.empty()) {
         size_t i;
         for (i = 0; i < prog->function_stack.size(); ++i)
-            printf("->");
-        printf("%s:", prog->function_stack.back());
+            fprintf(prog->out, "->");
+        fprintf(prog->out, "%s:", prog->function_stack.back());
     }
-    printf(" <> %-12s", util_instr_str[st->opcode]);
+    fprintf(prog->out, " <> %-12s", util_instr_str[st->opcode]);
     if (st->opcode >= INSTR_IF &&
         st->opcode <= INSTR_IFNOT)
     {
         trace_print_global(prog, st->o1.u1, TYPE_FLOAT);
-        printf("%d\n", st->o2.s1);
+        fprintf(prog->out, "%d\n", st->o2.s1);
     }
-    else if (st->opcode >= INSTR_CALL0 &&
-             st->opcode <= INSTR_CALL8)
+    else if ((st->opcode >= INSTR_CALL0 &&
+              st->opcode <= INSTR_CALL8) ||
+             st->opcode == INSTR_TAILCALL)
     {
         trace_print_global(prog, st->o1.u1, TYPE_FUNCTION);
-        printf("\n");
+        if (st->opcode == INSTR_TAILCALL)
+            fprintf(prog->out, "%u", st->o2.u1);
+        fprintf(prog->out, "\n");
     }
     else if (st->opcode == INSTR_GOTO)
     {
-        printf("%i\n", st->o1.s1);
+        fprintf(prog->out, "%i\n", st->o1.s1);
     }
     else
     {
@@ -397,8 +1042,21 @@ static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *s
             case INSTR_SUB_V:
             case INSTR_EQ_V:
             case INSTR_NE_V:
+            case INSTR_BITAND_V:
+            case INSTR_BITOR_V:
+            case INSTR_BITXOR_V:
+            case INSTR_CROSS:
                 t[0] = t[1] = t[2] = TYPE_VECTOR;
                 break;
+            case INSTR_BITAND_VF:
+            case INSTR_BITOR_VF:
+            case INSTR_BITXOR_VF:
+            case INSTR_LOADA_V:
+                t[0] = t[2] = TYPE_VECTOR;
+                break;
+            case INSTR_STOREA_V:
+                t[0] = t[1] = TYPE_VECTOR;
+                break;
             case INSTR_EQ_S:
             case INSTR_NE_S:
                 t[0] = t[1] = TYPE_STRING;
@@ -439,19 +1097,31 @@ static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *s
                 break;
         }
         if (t[0] >= 0) trace_print_global(prog, st->o1.u1, t[0]);
-        else           printf("(none),          ");
+        else           fprintf(prog->out, "(none),          ");
         if (t[1] >= 0) trace_print_global(prog, st->o2.u1, t[1]);
-        else           printf("(none),          ");
+        else           fprintf(prog->out, "(none),          ");
         if (t[2] >= 0) trace_print_global(prog, st->o3.u1, t[2]);
-        else           printf("(none)");
-        printf("\n");
+        else           fprintf(prog->out, "(none)");
+        fprintf(prog->out, "\n");
+    }
+}
+
+static void prog_enterparams(qc_program_t *prog, prog_section_function_t *func) {
+    size_t  parampos = func->firstlocal;
+    int32_t p;
+
+    for (p = 0; p < func->nargs; ++p)
+    {
+        size_t s;
+        for (s = 0; s < func->argsize[p]; ++s) {
+            prog->globals[parampos] = prog->globals[OFS_PARM0 + 3*p + s];
+            ++parampos;
+        }
     }
 }
 
 static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *func) {
     qc_exec_stack_t st;
-    size_t  parampos;
-    int32_t p;
 
     /* back up locals */
     st.localsp  = prog->localstack.size();
@@ -481,18 +1151,40 @@ static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *f
     }
 #endif
 
-    /* copy parameters */
-    parampos = func->firstlocal;
-    for (p = 0; p < func->nargs; ++p)
+    prog_enterparams(prog, func);
+    prog->stack.emplace_back(st);
+
+    return func->entry;
+}
+
+/*
+ * Executes func in place of the current function: its locals are restored
+ * as if it returned and func's are backed up in their place, so neither
+ * the call stack nor the local stack grows.  The return goes to the
+ * current function's caller.
+ */
+static qcint_t prog_tailcallfunction(qc_program_t *prog, prog_section_function_t *func) {
+    qc_exec_stack_t &st = prog->stack.back();
+
+    if (prog->xflags & VMXF_TRACE) {
+        if (!prog->function_stack.empty())
+            prog->function_stack.back() = prog_getstring(prog, func->name);
+    }
+
+#ifndef QCVM_BACKUP_STRATEGY_CALLER_VARS
     {
-        size_t s;
-        for (s = 0; s < func->argsize[p]; ++s) {
-            prog->globals[parampos] = prog->globals[OFS_PARM0 + 3*p + s];
-            ++parampos;
-        }
+        qcint_t *globals = &prog->globals[0] + st.function->firstlocal;
+        if (st.function->locals)
+            memcpy(globals, &prog->localstack[st.localsp], st.function->locals * sizeof(prog->localstack[0]));
+        prog->localstack.resize(st.localsp);
+
+        globals = &prog->globals[0] + func->firstlocal;
+        prog->localstack.insert(prog->localstack.end(), globals, globals + func->locals);
     }
+#endif
 
-    prog->stack.emplace_back(st);
+    prog_enterparams(prog, func);
+    st.function = func;
 
     return func->entry;
 }
@@ -536,6 +1228,16 @@ bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags,
     prog_section_statement_t *st;
 
     prog->vmerror = 0;
+
+    if (!prog->natives.empty() && prog->natives[func - &prog->functions[0]]) {
+        prog_native_sync(prog);
+        prog->natives[func - &prog->functions[0]](&prog->rt);
+        /* native code does not track which entities it wrote to */
+        for (auto &it : prog->entitypages)
+            it.reset();
+        return !prog->vmerror;
+    }
+
     prog->xflags = flags;
 
     st = &prog->code[0] + prog_enterfunction(prog, func);
@@ -545,27 +1247,38 @@ bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags,
         default:
         case 0:
         {
+            /* verified programs skip the checks prog_verify did */
+            if (prog->verified) {
 #define QCVM_LOOP    1
 #define QCVM_PROFILE 0
 #define QCVM_TRACE   0
+#define QCVM_CHECKED 0
+#               include __FILE__
+            }
+#define QCVM_PROFILE 0
+#define QCVM_TRACE   0
+#define QCVM_CHECKED 1
 #           include __FILE__
         }
         case (VMXF_TRACE):
         {
 #define QCVM_PROFILE 0
 #define QCVM_TRACE   1
+#define QCVM_CHECKED 1
 #           include __FILE__
         }
         case (VMXF_PROFILE):
         {
 #define QCVM_PROFILE 1
 #define QCVM_TRACE   0
+#define QCVM_CHECKED 1
 #           include __FILE__
         }
         case (VMXF_TRACE|VMXF_PROFILE):
         {
 #define QCVM_PROFILE 1
 #define QCVM_TRACE   1
+#define QCVM_CHECKED 1
 #           include __FILE__
         }
     };
@@ -585,6 +1298,10 @@ cleanup:
 
 #include <math.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 const char *type_name[TYPE_COUNT] = {
     "void",
     "string",
@@ -632,12 +1349,12 @@ static int qc_print(qc_program_t *prog) {
     for (i = 0; i < (size_t)prog->argc; ++i) {
         qcany_t *str = (qcany_t*)(&prog->globals[0] + OFS_PARM0 + 3*i);
         laststr = prog_getstring(prog, str->string);
-        printf("%s", laststr);
+        fprintf(prog->out, "%s", laststr);
     }
     if (laststr && (prog->xflags & VMXF_TRACE)) {
         size_t len = strlen(laststr);
         if (!len || laststr[len-1] != '\n')
-            printf("\n");
+            fprintf(prog->out, "\n");
     }
     return 0;
 }
@@ -866,17 +1583,23 @@ static void version(void) {
 }
 
 static void usage(void) {
-    printf("usage: %s [options] [parameters] file\n", arg0);
+    printf("usage: %s [options] [parameters] file...\n", arg0);
     printf("options:\n");
     printf("  -h, --help         print this message\n"
            "  -trace             trace the execution\n"
            "  -profile           perform profiling during execution\n"
+           "  -profile-out file  profile and write the counters for gmqcc -fprofile-use\n"
            "  -info              print information from the prog's header\n"
            "  -disasm            disassemble and exit\n"
            "  -disasm-func func  disassemble and exit\n"
            "  -printdefs         list the defs section\n"
            "  -printfields       list the field section\n"
            "  -printfuns         list functions information\n"
+           "  -verify            analyse the program and print the results as JSON\n"
+           "  -rollback <n>      run main n times, rolling back and forth after each\n"
+           "  -manifest file     also execute the programs listed in file\n"
+           "  -j <n>             number of programs to execute in parallel\n"
+           "  -native file       execute the functions in file, built from gmqcc -emit-c\n"
            "  -v                 be verbose\n"
            "  -vv                be even more verbose\n");
     printf("parameters:\n");
@@ -914,21 +1637,744 @@ static void prog_main_setparams(qc_program_t *prog) {
     }
 }
 
-static void prog_disasm_function(qc_program_t *prog, size_t id);
+/*
+ * Running more than one program: every program is loaded and has its
+ * main executed on one of a pool of threads, its output going to a
+ * temporary file.  Once all of them ran their outputs are printed in
+ * the order the programs were given, followed by a summary.
+ */
+struct qcvm_job {
+    std::string file;
+    std::string output;
+    const char *status;
+    bool        success;
+};
 
-int main(int argc, char **argv) {
-    size_t      i;
+static bool qcvm_read_manifest(const char *file, std::vector<std::string> &list) {
+    FILE   *fp = fopen(file, "r");
+    char   *line = nullptr;
+    size_t  size = 0;
+
+    if (!fp) {
+        fprintf(stderr, "failed to open manifest '%s': %s\n", file, util_strerror(errno));
+        return false;
+    }
+    while (util_getline(&line, &size, fp) != EOF) {
+        char *beg = line;
+        char *end = line + strlen(line);
+        while (*beg == ' ' || *beg == '\t')
+            ++beg;
+        while (end > beg && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            --end;
+        if (end == beg || *beg == '#')
+            continue;
+        list.emplace_back(beg, end);
+    }
+    mem_d(line);
+    fclose(fp);
+    return true;
+}
+
+static void qcvm_run_job(qcvm_job *job, size_t xflags) {
+    qc_program_t *prog = prog_load(job->file.c_str(), false);
     qcint_t       fnmain = -1;
-    qc_program_t *prog;
-    size_t      xflags = VMXF_DEFAULT;
-    bool        opts_printfields = false;
+    FILE         *out;
+    char          buffer[4096];
+    size_t        read;
+
+    job->success = false;
+    if (!prog) {
+        job->status = "failed to load";
+        return;
+    }
+    if (!(out = tmpfile())) {
+        job->status = "failed to capture output";
+        prog_delete(prog);
+        return;
+    }
+
+    prog->builtins       = qc_builtins;
+    prog->builtins_count = GMQCC_ARRAY_COUNT(qc_builtins);
+    prog->out            = out;
+
+    for (size_t i = 1; i < prog->functions.size(); ++i) {
+        if (!strcmp(prog_getstring(prog, prog->functions[i].name), "main"))
+            fnmain = (qcint_t)i;
+    }
+    if (fnmain > 0) {
+        prog_main_setparams(prog);
+        job->success = prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
+        job->status  = job->success ? "ok" : "failed";
+    } else {
+        job->status = "no main function";
+    }
+    prog_delete(prog);
+
+    rewind(out);
+    while ((read = fread(buffer, 1, sizeof(buffer), out)) > 0)
+        job->output.append(buffer, read);
+    fclose(out);
+}
+
+static bool qcvm_run_jobs(const std::vector<std::string> &files, size_t threads, size_t xflags) {
+    std::vector<qcvm_job>    jobs(files.size());
+    std::vector<std::thread> pool;
+    std::atomic<size_t>      next(0);
+    size_t                   failed = 0;
+
+    for (size_t i = 0; i < files.size(); ++i)
+        jobs[i].file = files[i];
+
+    if (!threads)
+        threads = 1;
+    if (threads > jobs.size())
+        threads = jobs.size();
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < jobs.size())
+                qcvm_run_job(&jobs[i], xflags);
+        });
+    }
+    for (auto &it : pool)
+        it.join();
+
+    for (auto &it : jobs) {
+        printf("==> %s (%s)\n", it.file.c_str(), it.status);
+        fwrite(it.output.data(), 1, it.output.size(), stdout);
+        if (!it.output.empty() && it.output.back() != '\n')
+            putchar('\n');
+        if (!it.success)
+            ++failed;
+    }
+    printf("%zu programs: %zu succeeded, %zu failed\n", jobs.size(), jobs.size() - failed, failed);
+    return !failed;
+}
+
+/*
+ * -rollback: runs main once per frame, keeping the state from one frame to
+ * the next, and after each frame rolls the program back to the snapshot of
+ * the previous one and forward again.  Both restored states are compared
+ * with plain copies, which share no pages, so a write the entity pages
+ * missed shows up as a mismatch.  With -v the average cost of a snapshot,
+ * a rollback and a plain copy are printed.
+ */
+struct qcvm_state {
+    std::vector<qcint_t> globals;
+    std::vector<qcint_t> entities;
+    std::vector<bool>    entitypool;
+    std::vector<char>    strings;
+    size_t               tempstring_at;
+    qcint_t              count;
+};
+
+static void qcvm_state_copy(qc_program_t *prog, qcvm_state &state) {
+    size_t chunk = QCVM_ENTITY_CHUNK * prog->entityfields;
+    state.globals    = prog->globals;
+    state.entitypool = prog->entitypool;
+    state.strings    = prog->strings;
+    state.entities.clear();
+    for (auto &it : prog->entitychunks)
+        state.entities.insert(state.entities.end(), it.get(), it.get() + chunk);
+    state.tempstring_at = prog->tempstring_at;
+    state.count         = prog->entities;
+}
+
+static bool qcvm_state_check(qc_program_t *prog, const qcvm_state &state, size_t frame, const char *when) {
+    size_t chunk = QCVM_ENTITY_CHUNK * prog->entityfields;
+    size_t i;
+    const char *what = nullptr;
+
+    if (prog->globals != state.globals)
+        what = "globals";
+    else if (prog->entities != state.count || prog->entitypool != state.entitypool ||
+             prog->entitychunks.size() * chunk != state.entities.size())
+        what = "entity pool";
+    else if (prog->strings != state.strings || prog->tempstring_at != state.tempstring_at)
+        what = "tempstrings";
+    for (i = 0; !what && i < prog->entitychunks.size(); ++i) {
+        if (memcmp(prog->entitychunks[i].get(), &state.entities[i * chunk], chunk * sizeof(qcint_t)))
+            what = "entities";
+    }
+    if (what)
+        fprintf(stderr, "frame %zu: the state restored from %s it has different %s\n", frame, when, what);
+    return !what;
+}
+
+static bool qcvm_rollback(qc_program_t *prog, qcint_t fnmain, size_t xflags, size_t frames, int verbose) {
+    typedef std::chrono::steady_clock clock;
+    qcvm_state     before, after;
+    qc_snapshot_t *last = prog_snapshot(prog);
+    double         copied = 0, snapshot = 0, restore = 0;
+    bool           ok = true;
+    size_t         frame;
+
+    qcvm_state_copy(prog, before);
+    for (frame = 0; ok && frame < frames; ++frame) {
+        qc_snapshot_t *snap;
+        clock::time_point start;
+
+        ok = prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
+
+        start = clock::now();
+        qcvm_state_copy(prog, after);
+        copied += std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+        start = clock::now();
+        snap = prog_snapshot(prog);
+        snapshot += std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+        start = clock::now();
+        prog_restore(prog, last);
+        restore += std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+        ok = qcvm_state_check(prog, before, frame, "before") && ok;
+        prog_restore(prog, snap);
+        ok = qcvm_state_check(prog, after, frame, "after") && ok;
+
+        prog_snapshot_delete(last);
+        last = snap;
+        std::swap(before, after);
+    }
+    prog_snapshot_delete(last);
+
+    if (verbose && frame) {
+        fprintf(stderr, "%zu frames, %zu entities: snapshot %.1fus, rollback %.1fus, full copy %.1fus\n",
+                frame, (size_t)prog->entities, snapshot / frame, restore / frame, copied / frame);
+    }
+    return ok;
+}
+
+/*
+ * -verify: a static analysis of the whole program printed as JSON.  Each
+ * function gets a control flow graph over its statements which is walked
+ * once, operands are checked against the types of the globals' defs,
+ * writes into the locals of other functions are reported since those
+ * aren't restored when the writer returns, and the deepest chain of calls
+ * through constant function globals is measured.  Everything is linear in
+ * the size of the program apart from sorting the function entries.
+ */
+struct qcvm_finding {
+    bool        error;
+    const char *kind;
+    size_t      function;
+    qcint_t     statement;
+    std::string message;
+};
+
+static void json_print_string(const char *str) {
+    putchar('"');
+    for (; *str; ++str) {
+        switch (*str) {
+            case '"':  fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n",  stdout); break;
+            case '\t': fputs("\\t",  stdout); break;
+            default:
+                if ((unsigned char)*str < 0x20)
+                    printf("\\u%04x", (unsigned char)*str);
+                else
+                    putchar(*str);
+        }
+    }
+    putchar('"');
+}
+
+/* the types an instruction expects its operands to be, -1 for any */
+static void prog_instr_types(uint16_t opcode, int type[3]) {
+    type[0] = type[1] = type[2] = -1;
+    switch (opcode) {
+        case INSTR_MUL_F: case INSTR_DIV_F: case INSTR_ADD_F: case INSTR_SUB_F:
+        case INSTR_EQ_F:  case INSTR_NE_F:  case INSTR_LE:    case INSTR_GE:
+        case INSTR_LT:    case INSTR_GT:    case INSTR_BITAND: case INSTR_BITOR:
+        case INSTR_BITXOR:
+            type[0] = type[1] = type[2] = TYPE_FLOAT;
+            break;
+        case INSTR_MUL_V:  type[0] = type[1] = TYPE_VECTOR; type[2] = TYPE_FLOAT;  break;
+        case INSTR_MUL_FV: type[0] = TYPE_FLOAT;  type[1] = type[2] = TYPE_VECTOR; break;
+        case INSTR_MUL_VF: type[0] = type[2] = TYPE_VECTOR; type[1] = TYPE_FLOAT;  break;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+        case INSTR_BITAND_V:
+        case INSTR_BITOR_V:
+        case INSTR_BITXOR_V:
+        case INSTR_CROSS:  type[0] = type[1] = type[2] = TYPE_VECTOR; break;
+        case INSTR_BITAND_VF:
+        case INSTR_BITOR_VF:
+        case INSTR_BITXOR_VF: type[0] = type[2] = TYPE_VECTOR; type[1] = TYPE_FLOAT; break;
+
+        /* arrays of any single global type go through the _F forms */
+        case INSTR_LOADA_F:  type[1] = TYPE_FLOAT; break;
+        case INSTR_LOADA_V:  type[0] = type[2] = TYPE_VECTOR; type[1] = TYPE_FLOAT; break;
+        case INSTR_STOREA_F: type[2] = TYPE_FLOAT; break;
+        case INSTR_STOREA_V: type[0] = type[1] = TYPE_VECTOR; type[2] = TYPE_FLOAT; break;
+        case INSTR_EQ_V:
+        case INSTR_NE_V:   type[0] = type[1] = TYPE_VECTOR;   type[2] = TYPE_FLOAT; break;
+        case INSTR_EQ_S:
+        case INSTR_NE_S:   type[0] = type[1] = TYPE_STRING;   type[2] = TYPE_FLOAT; break;
+        case INSTR_EQ_E:
+        case INSTR_NE_E:   type[0] = type[1] = TYPE_ENTITY;   type[2] = TYPE_FLOAT; break;
+        case INSTR_EQ_FNC:
+        case INSTR_NE_FNC: type[0] = type[1] = TYPE_FUNCTION; type[2] = TYPE_FLOAT; break;
+
+        case INSTR_LOAD_F:   type[2] = TYPE_FLOAT;    goto load;
+        case INSTR_LOAD_V:   type[2] = TYPE_VECTOR;   goto load;
+        case INSTR_LOAD_S:   type[2] = TYPE_STRING;   goto load;
+        case INSTR_LOAD_ENT: type[2] = TYPE_ENTITY;   goto load;
+        case INSTR_LOAD_FLD: type[2] = TYPE_FIELD;    goto load;
+        case INSTR_LOAD_FNC: type[2] = TYPE_FUNCTION; goto load;
+        case INSTR_ADDRESS:  type[2] = TYPE_POINTER;
+        load:
+            type[0] = TYPE_ENTITY;
+            type[1] = TYPE_FIELD;
+            break;
+
+        case INSTR_STORE_V:   type[0] = type[1] = TYPE_VECTOR;   break;
+        case INSTR_STORE_S:   type[0] = type[1] = TYPE_STRING;   break;
+        case INSTR_STORE_ENT: type[0] = type[1] = TYPE_ENTITY;   break;
+        case INSTR_STORE_FLD: type[0] = type[1] = TYPE_FIELD;    break;
+        case INSTR_STORE_FNC: type[0] = type[1] = TYPE_FUNCTION; break;
+
+        case INSTR_STOREP_F:   type[0] = TYPE_FLOAT;    type[1] = TYPE_POINTER; break;
+        case INSTR_STOREP_V:   type[0] = TYPE_VECTOR;   type[1] = TYPE_POINTER; break;
+        case INSTR_STOREP_S:   type[0] = TYPE_STRING;   type[1] = TYPE_POINTER; break;
+        case INSTR_STOREP_ENT: type[0] = TYPE_ENTITY;   type[1] = TYPE_POINTER; break;
+        case INSTR_STOREP_FLD: type[0] = TYPE_FIELD;    type[1] = TYPE_POINTER; break;
+        case INSTR_STOREP_FNC: type[0] = TYPE_FUNCTION; type[1] = TYPE_POINTER; break;
+
+        case INSTR_NOT_F:   type[0] = TYPE_FLOAT;    type[2] = TYPE_FLOAT; break;
+        case INSTR_NOT_V:   type[0] = TYPE_VECTOR;   type[2] = TYPE_FLOAT; break;
+        case INSTR_NOT_S:   type[0] = TYPE_STRING;   type[2] = TYPE_FLOAT; break;
+        case INSTR_NOT_ENT: type[0] = TYPE_ENTITY;   type[2] = TYPE_FLOAT; break;
+        case INSTR_NOT_FNC: type[0] = TYPE_FUNCTION; type[2] = TYPE_FLOAT; break;
+
+        case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+        case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+        case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+        case INSTR_TAILCALL:
+            type[0] = TYPE_FUNCTION;
+            break;
+        case INSTR_STATE:
+            type[0] = TYPE_FLOAT;
+            type[1] = TYPE_FUNCTION;
+            break;
+    }
+}
+
+/* the reasons prog_check gives become findings of the statement's function */
+struct qcvm_rejections {
+    std::vector<qcvm_finding> *findings;
+    const std::vector<size_t> *owner;
+};
+
+static void prog_reject_finding(void *user, qcint_t statement, const char *reason) {
+    qcvm_rejections *r = (qcvm_rejections*)user;
+    size_t function = statement >= 0 ? (*r->owner)[statement] : 0;
+    r->findings->push_back({ false, "unverified", function, statement, reason });
+}
+
+static bool prog_instr_is_call(uint16_t opcode) {
+    return (opcode >= INSTR_CALL0 && opcode <= INSTR_CALL8) || opcode == INSTR_TAILCALL;
+}
+
+static int prog_verify_report(qc_program_t *prog) {
+    std::vector<qcvm_finding>   findings;
+    std::vector<bool>           written;
+    std::vector<size_t>         owner(prog->code.size(), 0);
+    std::vector<int>            cover(prog->globals.size() + 1, 0);
+    std::vector<uint32_t>       defmask(prog->globals.size(), 0);
+    std::vector<std::pair<qcint_t, size_t>> entries;
+    std::vector<size_t>         begin(prog->functions.size(), 0);
+    std::vector<size_t>         end(prog->functions.size(), 0);
+    std::vector<std::vector<size_t>> callees(prog->functions.size());
+    size_t globals = prog->globals.size();
+    size_t count   = prog->code.size();
+    size_t blocks = 0, edges = 0, dynamic_calls = 0, max_depth = 0;
+    size_t errors = 0, warnings = 0;
+    std::vector<size_t> recursive;
+    char   buffer[512];
+    size_t i, f;
+
+#define FINDING(ERR, KIND, FUNC, STMT, ...) do {                 \
+        util_snprintf(buffer, sizeof(buffer), __VA_ARGS__);      \
+        findings.push_back({ (ERR), (KIND), (FUNC), (qcint_t)(STMT), buffer }); \
+    } while (0)
+
+    /* function table and statement ownership */
+    for (f = 1; f < prog->functions.size(); ++f) {
+        const prog_section_function_t &func = prog->functions[f];
+        if (func.entry < 0)
+            continue;
+        if (!prog_function_sane(prog, func)) {
+            FINDING(true, "function", f, -1, "invalid entry, locals or parameters");
+            continue;
+        }
+        entries.emplace_back(func.entry, f);
+        cover[func.firstlocal]++;
+        cover[func.firstlocal + func.locals]--;
+    }
+    std::sort(entries.begin(), entries.end());
+    for (i = 0; i < entries.size(); ++i) {
+        size_t from = entries[i].first;
+        size_t to   = i+1 < entries.size() ? (size_t)entries[i+1].first : count;
+        f = entries[i].second;
+        begin[f] = from;
+        end[f]   = to;
+        for (size_t k = from; k < to; ++k)
+            owner[k] = f;
+    }
+    for (i = 1; i < globals; ++i)
+        cover[i] += cover[i-1];
+
+    /*
+     * types of the defs which live outside of every function's locals,
+     * the extra parameters take any type despite being vectors
+     */
+    for (auto &it : prog->defs) {
+        int type = it.type & DEF_TYPEMASK;
+        if (it.offset >= globals || cover[it.offset] || type >= 32)
+            continue;
+        if (!strncmp(prog_getstring(prog, it.name), "EXTPARM#", 8))
+            continue;
+        defmask[it.offset] |= 1u << type;
+    }
+
+    prog_written_globals(prog, written);
+
+    for (i = 0; i < count; ++i) {
+        const prog_section_statement_t &st = prog->code[i];
+        const prog_section_function_t  *func = owner[i] ? &prog->functions[owner[i]] : nullptr;
+        int size[3], type[3], w;
+
+        if (!prog_instr_operands(st.opcode, size, &w)) {
+            FINDING(true, "opcode", owner[i], i, "illegal instruction %u", (unsigned)st.opcode);
+            continue;
+        }
+        prog_instr_types(st.opcode, type);
+        for (int o = 0; o < 3; ++o) {
+            uint32_t u = (&st.o1)[o].u1;
+            uint32_t mask;
+            if (!size[o])
+                continue;
+            if ((size_t)u + size[o] > globals) {
+                FINDING(true, "operand", owner[i], i, "operand %i (global %u) is out of range", o+1, u);
+                continue;
+            }
+            mask = defmask[u];
+            if (type[o] >= 0 && mask && !(mask & (1u << type[o])) &&
+                !(type[o] == TYPE_FLOAT && (mask & (1u << TYPE_VECTOR))) &&
+                !(mask & ((1u << TYPE_VOID) | (1u << TYPE_INTEGER) | (1u << TYPE_VARIANT))))
+            {
+                FINDING(false, "type", owner[i], i, "%s expects operand %i (global %u) to be a %s",
+                        util_instr_str[st.opcode], o+1, u, type_name[type[o]]);
+            }
+            if (o == w && func && cover[u] &&
+                (u < func->firstlocal || u + size[o] > func->firstlocal + func->locals))
+            {
+                FINDING(false, "locals", owner[i], i,
+                        "writes global %u which belongs to the locals of other functions", u);
+            }
+        }
+
+        if (prog_instr_is_call(st.opcode) && (size_t)st.o1.u1 < globals) {
+            if (written[st.o1.u1]) {
+                ++dynamic_calls;
+            } else {
+                qcint_t fn = prog->globals[st.o1.u1];
+                if (fn <= 0 || (size_t)fn >= prog->functions.size())
+                    FINDING(true, "call", owner[i], i, "calls invalid function %i", (int)fn);
+                else if (prog->functions[fn].entry >= 0 && owner[i])
+                    callees[owner[i]].push_back(fn);
+            }
+        }
+    }
+
+    /* control flow: one walk over each function's graph */
+    std::vector<bool>    reached(count, false);
+    std::vector<bool>    leader(count, false);
+    std::vector<size_t>  work;
+    for (auto &e : entries) {
+        f = e.second;
+        work.clear();
+        work.push_back(begin[f]);
+        reached[begin[f]] = true;
+        leader[begin[f]]  = true;
+        while (!work.empty()) {
+            size_t  at = work.back();
+            int64_t next[2];
+            int     nexts = 0;
+            const prog_section_statement_t &st = prog->code[at];
+            work.pop_back();
+
+            switch (st.opcode) {
+                case INSTR_DONE:
+                case INSTR_RETURN:
+                case INSTR_TAILCALL:
+                    break;
+                case INSTR_GOTO:
+                    next[nexts++] = (int64_t)at + st.o1.s1;
+                    break;
+                case INSTR_IF:
+                case INSTR_IFNOT:
+                    next[nexts++] = (int64_t)at + 1;
+                    next[nexts++] = (int64_t)at + st.o2.s1;
+                    break;
+                default:
+                    next[nexts++] = (int64_t)at + 1;
+                    break;
+            }
+            for (int n = 0; n < nexts; ++n) {
+                if (next[n] < (int64_t)begin[f] || next[n] >= (int64_t)end[f]) {
+                    if (n == 0 && st.opcode != INSTR_GOTO)
+                        FINDING(true, "fallthrough", f, at, "execution runs past the end of the function");
+                    else
+                        FINDING(true, "jump", f, at, "jumps to statement %lli outside of the function",
+                                (long long)next[n]);
+                    continue;
+                }
+                ++edges;
+                if (st.opcode == INSTR_GOTO || st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT)
+                    leader[next[n]] = true;
+                if (!reached[next[n]]) {
+                    reached[next[n]] = true;
+                    work.push_back(next[n]);
+                }
+            }
+        }
+
+        /* unreachable statements, except the DONE marking a function's end */
+        for (i = begin[f]; i < end[f]; ++i) {
+            size_t from = i;
+            if (reached[i])
+                continue;
+            while (i+1 < end[f] && !reached[i+1])
+                ++i;
+            if (i == end[f]-1 && from == i && prog->code[i].opcode == INSTR_DONE)
+                continue;
+            FINDING(false, "unreachable", f, from, "statements %zu to %zu are unreachable", from, i);
+        }
+        for (i = begin[f]; i < end[f]; ++i)
+            if (reached[i] && leader[i])
+                ++blocks;
+    }
+
+    /* deepest call chain, iteratively, ignoring edges back into the chain */
+    {
+        std::vector<size_t>   depth(prog->functions.size(), 0);
+        std::vector<uint8_t>  state(prog->functions.size(), 0); /* 0 new, 1 active, 2 done */
+        std::vector<std::pair<size_t, size_t>> stack;
+        std::vector<bool>     inrecursion(prog->functions.size(), false);
+        for (auto &e : entries) {
+            if (state[e.second])
+                continue;
+            stack.emplace_back(e.second, 0);
+            state[e.second] = 1;
+            while (!stack.empty()) {
+                size_t fn = stack.back().first;
+                size_t &c = stack.back().second;
+                if (c < callees[fn].size()) {
+                    size_t callee = callees[fn][c++];
+                    if (state[callee] == 0) {
+                        state[callee] = 1;
+                        stack.emplace_back(callee, 0);
+                    } else if (state[callee] == 1) {
+                        if (!inrecursion[callee]) {
+                            inrecursion[callee] = true;
+                            recursive.push_back(callee);
+                        }
+                    } else if (depth[callee] > depth[fn]) {
+                        depth[fn] = depth[callee];
+                    }
+                    continue;
+                }
+                depth[fn] += 1;
+                state[fn] = 2;
+                if (depth[fn] > max_depth)
+                    max_depth = depth[fn];
+                stack.pop_back();
+                if (!stack.empty() && depth[fn] > depth[stack.back().first])
+                    depth[stack.back().first] = depth[fn];
+            }
+        }
+    }
+#undef FINDING
+
+    /* why the interpreter keeps its checks for this program */
+    qcvm_rejections rejections = { &findings, &owner };
+    prog_check(prog, prog_reject_finding, &rejections);
+
+    for (auto &it : findings) {
+        if (it.error) ++errors;
+        else          ++warnings;
+    }
+
+    printf("{\n  \"file\": ");
+    json_print_string(prog->filename.c_str());
+    printf(",\n  \"verified\": %s,\n", prog->verified ? "true" : "false");
+    printf("  \"statements\": %zu,\n", count);
+    printf("  \"functions\": %zu,\n", entries.size());
+    printf("  \"blocks\": %zu,\n", blocks);
+    printf("  \"edges\": %zu,\n", edges);
+    printf("  \"max_call_depth\": %zu,\n", max_depth);
+    printf("  \"dynamic_calls\": %zu,\n", dynamic_calls);
+    printf("  \"recursive\": [");
+    for (i = 0; i < recursive.size(); ++i) {
+        printf(i ? ", " : "");
+        json_print_string(prog_getstring(prog, prog->functions[recursive[i]].name));
+    }
+    printf("],\n  \"errors\": %zu,\n  \"warnings\": %zu,\n  \"findings\": [", errors, warnings);
+    for (i = 0; i < findings.size(); ++i) {
+        const qcvm_finding &it = findings[i];
+        printf("%s\n    { \"severity\": \"%s\", \"kind\": \"%s\", \"function\": ",
+               i ? "," : "", it.error ? "error" : "warning", it.kind);
+        if (it.function)
+            json_print_string(prog_getstring(prog, prog->functions[it.function].name));
+        else
+            printf("null");
+        if (it.statement >= 0)
+            printf(", \"statement\": %i", (int)it.statement);
+        else
+            printf(", \"statement\": null");
+        printf(", \"message\": ");
+        json_print_string(it.message.c_str());
+        printf(" }");
+    }
+    printf("%s]\n}\n", findings.empty() ? "" : "\n  ");
+    return (int)errors;
+}
+
+/*
+ * Reads the line and column of every statement from the .lno file
+ * gmqcc writes next to the program with -flno.
+ */
+static bool prog_load_lno(qc_program_t *prog, std::vector<uint32_t> &lines, std::vector<uint32_t> &columns) {
+    std::string file = prog->filename;
+    size_t      dot  = file.find_last_of("./");
+    char        magic[4];
+    uint32_t    header[5];
+    FILE       *fp;
+    bool        ok;
+
+    if (dot != std::string::npos && file[dot] == '.')
+        file.erase(dot);
+    file += ".lno";
+
+    if (!(fp = fopen(file.c_str(), "rb"))) {
+        fprintf(stderr, "failed to open '%s', compile the program with -flno to profile it\n", file.c_str());
+        return false;
+    }
+
+    lines.resize(prog->code.size());
+    columns.resize(prog->code.size());
+    ok = fread(magic, sizeof(magic), 1, fp) == 1 &&
+         fread(header, sizeof(header), 1, fp) == 1;
+    util_endianswap(header, 5, sizeof(header[0]));
+    ok = ok && !memcmp(magic, "LNOF", 4) && header[0] == 1 &&
+         header[1] == prog->defs.size() && header[3] == prog->fields.size() &&
+         header[4] == prog->code.size() &&
+         fread(&lines[0], sizeof(lines[0]), lines.size(), fp) == lines.size() &&
+         fread(&columns[0], sizeof(columns[0]), columns.size(), fp) == columns.size();
+    fclose(fp);
+
+    if (!ok) {
+        fprintf(stderr, "'%s' does not belong to '%s'\n", file.c_str(), prog->filename.c_str());
+        return false;
+    }
+    util_endianswap(&lines[0], lines.size(), sizeof(lines[0]));
+    util_endianswap(&columns[0], columns.size(), sizeof(columns[0]));
+    return true;
+}
+
+/*
+ * Writes the counters collected with -profile for gmqcc -fprofile-use.
+ * Everything is keyed by function name and source position rather than
+ * by statement so the profile survives recompiling with other flags:
+ *
+ *     function <name> <calls>
+ *     line <function> <line> <executions of its hottest statement>
+ *     branch <function> <line> <column> <times true> <times false>
+ */
+static bool prog_write_profile(qc_program_t *prog, const char *filename) {
+    std::vector<std::pair<qcint_t, size_t>> entries;
+    std::vector<uint32_t> lines, columns;
+    FILE  *fp;
+    size_t i, k;
+
+    if (!prog_load_lno(prog, lines, columns))
+        return false;
+    if (!(fp = fopen(filename, "w"))) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", filename, util_strerror(errno));
+        return false;
+    }
+
+    for (i = 1; i < prog->functions.size(); ++i) {
+        if (prog->functions[i].entry >= 0 && (size_t)prog->functions[i].entry < prog->code.size())
+            entries.emplace_back(prog->functions[i].entry, i);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    fprintf(fp, "# qcvm profile of %s\n", prog->filename.c_str());
+    for (i = 0; i < entries.size(); ++i) {
+        const prog_section_function_t &func = prog->functions[entries[i].second];
+        const char *name = prog_getstring(prog, func.name);
+        size_t      from = entries[i].first;
+        size_t      to   = i+1 < entries.size() ? (size_t)entries[i+1].first : prog->code.size();
+        std::map<uint32_t, size_t> hot;
+        std::map<std::pair<uint32_t, uint32_t>, std::pair<size_t, size_t>> branches;
+
+        fprintf(fp, "function %s %u\n", name, (unsigned)func.profile);
+        for (k = from; k < to; ++k) {
+            size_t ran   = prog->profile[k];
+            size_t taken = prog->profile_jumps[k];
+            size_t &line = hot[lines[k]];
+            if (ran > line)
+                line = ran;
+
+            if (prog->code[k].opcode != INSTR_IF && prog->code[k].opcode != INSTR_IFNOT)
+                continue;
+            std::pair<size_t, size_t> &b = branches[std::make_pair(lines[k], columns[k])];
+            if (prog->code[k].opcode == INSTR_IF) {
+                b.first  += taken;
+                b.second += ran - taken;
+            } else {
+                b.first  += ran - taken;
+                b.second += taken;
+            }
+        }
+        for (auto &it : hot) {
+            if (it.second)
+                fprintf(fp, "line %s %u %zu\n", name, (unsigned)it.first, it.second);
+        }
+        for (auto &it : branches) {
+            fprintf(fp, "branch %s %u %u %zu %zu\n", name, (unsigned)it.first.first,
+                    (unsigned)it.first.second, it.second.first, it.second.second);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+static void prog_disasm_function(qc_program_t *prog, size_t id);
+
+int main(int argc, char **argv) {
+    size_t      i;
+    qcint_t       fnmain = -1;
+    qc_program_t *prog;
+    size_t      xflags = VMXF_DEFAULT;
+    bool        opts_printfields = false;
     bool        opts_printdefs   = false;
     bool        opts_printfuns   = false;
     bool        opts_disasm      = false;
     bool        opts_info        = false;
+    bool        opts_verify      = false;
     bool        noexec           = false;
     const char *progsfile        = nullptr;
+    const char *nativefile       = nullptr;
+    const char *profilefile      = nullptr;
+    size_t      rollback         = 0;
     int         opts_v           = 0;
+    size_t      jobs             = std::thread::hardware_concurrency();
+    std::vector<std::string> progsfiles;
     std::vector<const char*> dis_list;
 
     arg0 = argv[0];
@@ -980,12 +2426,45 @@ int main(int argc, char **argv) {
             ++argv;
             xflags |= VMXF_PROFILE;
         }
+        else if (!strcmp(argv[1], "-profile-out")) {
+            --argc;
+            ++argv;
+            if (argc < 2) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            profilefile = argv[1];
+            xflags |= VMXF_PROFILE;
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-rollback")) {
+            --argc;
+            ++argv;
+            if (argc < 2) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            rollback = strtoul(argv[1], nullptr, 10);
+            if (!rollback) {
+                fprintf(stderr, "invalid number of frames: %s\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            --argc;
+            ++argv;
+        }
         else if (!strcmp(argv[1], "-info")) {
             --argc;
             ++argv;
             opts_info = true;
             noexec = true;
         }
+        else if (!strcmp(argv[1], "-verify")) {
+            --argc;
+            ++argv;
+            opts_verify = true;
+            noexec = true;
+        }
         else if (!strcmp(argv[1], "-disasm")) {
             --argc;
             ++argv;
@@ -1053,13 +2532,50 @@ int main(int argc, char **argv) {
             ++argv;
             break;
         }
-        else if (argv[1][0] != '-') {
-            if (progsfile) {
-                fprintf(stderr, "only 1 program file may be specified\n");
+        else if (!strcmp(argv[1], "-native")) {
+            --argc;
+            ++argv;
+            if (argc < 2) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            nativefile = argv[1];
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-manifest")) {
+            --argc;
+            ++argv;
+            if (argc < 2) {
                 usage();
                 exit(EXIT_FAILURE);
             }
-            progsfile = argv[1];
+            if (!qcvm_read_manifest(argv[1], progsfiles))
+                exit(EXIT_FAILURE);
+            --argc;
+            ++argv;
+        }
+        else if (!strncmp(argv[1], "-j", 2)) {
+            const char *num = argv[1] + 2;
+            --argc;
+            ++argv;
+            if (!*num) {
+                if (argc < 2) {
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+                num = argv[1];
+                --argc;
+                ++argv;
+            }
+            jobs = strtoul(num, nullptr, 10);
+            if (!jobs) {
+                fprintf(stderr, "invalid number of jobs: %s\n", num);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (argv[1][0] != '-') {
+            progsfiles.emplace_back(argv[1]);
             --argc;
             ++argv;
         }
@@ -1071,23 +2587,45 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (argc == 2 && !progsfile) {
-        progsfile = argv[1];
-        --argc;
-        ++argv;
-    }
+    for (; argc > 1; --argc, ++argv)
+        progsfiles.emplace_back(argv[1]);
 
-    if (!progsfile) {
+    if (progsfiles.empty()) {
         fprintf(stderr, "must specify a program to execute\n");
         usage();
         exit(EXIT_FAILURE);
     }
 
+    if (progsfiles.size() > 1) {
+        if (noexec) {
+            fprintf(stderr, "only a single program can be inspected\n");
+            exit(EXIT_FAILURE);
+        }
+        if (nativefile) {
+            fprintf(stderr, "native code can only be used with a single program\n");
+            exit(EXIT_FAILURE);
+        }
+        if (profilefile) {
+            fprintf(stderr, "only a single program can be profiled\n");
+            exit(EXIT_FAILURE);
+        }
+        if (rollback) {
+            fprintf(stderr, "only a single program can be rolled back\n");
+            exit(EXIT_FAILURE);
+        }
+        return qcvm_run_jobs(progsfiles, jobs, xflags) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    progsfile = progsfiles[0].c_str();
+
     prog = prog_load(progsfile, noexec);
     if (!prog) {
         fprintf(stderr, "failed to load program '%s'\n", progsfile);
         exit(EXIT_FAILURE);
     }
+    if (nativefile && !prog_load_native(prog, nativefile)) {
+        prog_delete(prog);
+        exit(EXIT_FAILURE);
+    }
 
     prog->builtins       = qc_builtins;
     prog->builtins_count = GMQCC_ARRAY_COUNT(qc_builtins);
@@ -1096,6 +2634,7 @@ int main(int argc, char **argv) {
         printf("Program's system-checksum = 0x%04x\n", (unsigned int)prog->crc16);
         printf("Entity field space: %u\n", (unsigned int)prog->entityfields);
         printf("Globals: %zu\n", prog->globals.size());
+        printf("Verified: %s\n", prog->verified ? "yes" : "no");
         printf("Counts:\n"
                "      code: %zu\n"
                "      defs: %zu\n"
@@ -1113,6 +2652,11 @@ int main(int argc, char **argv) {
         prog_delete(prog);
         return 0;
     }
+    if (opts_verify) {
+        int errors = prog_verify_report(prog);
+        prog_delete(prog);
+        return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
     for (i = 0; i < dis_list.size(); ++i) {
         size_t k;
         printf("Looking for `%s`\n", dis_list[i]);
@@ -1154,7 +2698,7 @@ int main(int argc, char **argv) {
                     case TYPE_STRING:
                         getstring = prog_getstring(prog, ((qcany_t*)(&prog->globals[0] + it.offset))->string);
                         printf(" [init: `");
-                        print_escaped_string(getstring, strlen(getstring));
+                        print_escaped_string(stdout, getstring, strlen(getstring));
                         printf("`]\n");
                         break;
                     default:
@@ -1216,13 +2760,24 @@ int main(int argc, char **argv) {
             if (!strcmp(name, "main"))
                 fnmain = (qcint_t)i;
         }
-        if (fnmain > 0)
+        if (fnmain > 0 && rollback) {
+            prog_main_setparams(prog);
+            if (!qcvm_rollback(prog, fnmain, xflags, rollback, opts_v)) {
+                prog_delete(prog);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (fnmain > 0)
         {
             prog_main_setparams(prog);
             prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
         }
         else
             fprintf(stderr, "No main function found\n");
+        if (profilefile && !prog_write_profile(prog, profilefile)) {
+            prog_delete(prog);
+            exit(EXIT_FAILURE);
+        }
     }
 
     prog_delete(prog);
@@ -1407,13 +2962,15 @@ while (prog->vmerror == 0) {
                 qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
                 goto cleanup;
             }
+#if QCVM_CHECKED
             if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields)) {
                 qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
                           prog->filename.c_str(),
                           OPB->_int);
                 goto cleanup;
             }
-            ed = prog_getedict(prog, OPA->edict);
+#endif
+            ed = (qcany_t*)prog_entity(prog, OPA->edict);
             OPC->_int = ((qcany_t*)( ((qcint_t*)ed) + OPB->_int ))->_int;
             break;
         case INSTR_LOAD_V:
@@ -1421,6 +2978,7 @@ while (prog->vmerror == 0) {
                 qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename.c_str());
                 goto cleanup;
             }
+#if QCVM_CHECKED
             if (OPB->_int < 0 || OPB->_int + 3 > (qcint_t)prog->entityfields)
             {
                 qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
@@ -1428,7 +2986,8 @@ while (prog->vmerror == 0) {
                           OPB->_int + 2);
                 goto cleanup;
             }
-            ed = prog_getedict(prog, OPA->edict);
+#endif
+            ed = (qcany_t*)prog_entity(prog, OPA->edict);
             ptr = (qcany_t*)( ((qcint_t*)ed) + OPB->_int );
             OPC->ivector[0] = ptr->ivector[0];
             OPC->ivector[1] = ptr->ivector[1];
@@ -1440,6 +2999,7 @@ while (prog->vmerror == 0) {
                 qcvmerror(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename.c_str(), OPA->edict);
                 goto cleanup;
             }
+#if QCVM_CHECKED
             if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields))
             {
                 qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
@@ -1447,9 +3007,9 @@ while (prog->vmerror == 0) {
                           OPB->_int);
                 goto cleanup;
             }
+#endif
 
-            ed = prog_getedict(prog, OPA->edict);
-            OPC->_int = ((qcint_t*)ed) - prog->entitydata.data() + OPB->_int;
+            OPC->_int = prog->entityfields * OPA->edict + OPB->_int;
             break;
 
         case INSTR_STORE_F:
@@ -1470,7 +3030,7 @@ while (prog->vmerror == 0) {
         case INSTR_STOREP_ENT:
         case INSTR_STOREP_FLD:
         case INSTR_STOREP_FNC:
-            if (OPB->_int < 0 || OPB->_int >= (qcint_t)prog->entitydata.size()) {
+            if (OPB->_int < 0 || OPB->_int >= prog->entities * (qcint_t)prog->entityfields) {
                 qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
                 goto cleanup;
             }
@@ -1479,11 +3039,14 @@ while (prog->vmerror == 0) {
                           prog->filename.c_str(),
                           prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
                           OPB->_int);
-            ptr = (qcany_t*)&prog->entitydata[OPB->_int];
+            ptr = (qcany_t*)(prog_entity(prog, OPB->_int / prog->entityfields) + OPB->_int % prog->entityfields);
             ptr->_int = OPA->_int;
+            prog_entity_written(prog, OPB->_int / prog->entityfields);
             break;
         case INSTR_STOREP_V:
-            if (OPB->_int < 0 || OPB->_int + 2 >= (qcint_t)prog->entitydata.size()) {
+            if (OPB->_int < 0 || OPB->_int >= prog->entities * (qcint_t)prog->entityfields ||
+                OPB->_int % prog->entityfields + 3 > prog->entityfields)
+            {
                 qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename.c_str(), OPB->_int);
                 goto cleanup;
             }
@@ -1492,10 +3055,11 @@ while (prog->vmerror == 0) {
                           prog->filename.c_str(),
                           prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
                           OPB->_int);
-            ptr = (qcany_t*)&prog->entitydata[OPB->_int];
+            ptr = (qcany_t*)(prog_entity(prog, OPB->_int / prog->entityfields) + OPB->_int % prog->entityfields);
             ptr->ivector[0] = OPA->ivector[0];
             ptr->ivector[1] = OPA->ivector[1];
             ptr->ivector[2] = OPA->ivector[2];
+            prog_entity_written(prog, OPB->_int / prog->entityfields);
             break;
 
         case INSTR_NOT_F:
@@ -1521,6 +3085,9 @@ while (prog->vmerror == 0) {
             /* this is consistent with darkplaces' behaviour */
             if(FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
+#if QCVM_PROFILE
+                prog->profile_jumps[st - &prog->code[0]]++;
+#endif
                 st += st->o2.s1 - 1;    /* offset the s++ */
                 if (++jumpcount >= maxjumps)
                     qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
@@ -1529,6 +3096,9 @@ while (prog->vmerror == 0) {
         case INSTR_IFNOT:
             if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
+#if QCVM_PROFILE
+                prog->profile_jumps[st - &prog->code[0]]++;
+#endif
                 st += st->o2.s1 - 1;    /* offset the s++ */
                 if (++jumpcount >= maxjumps)
                     qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
@@ -1575,6 +3145,41 @@ while (prog->vmerror == 0) {
                 goto cleanup;
             break;
 
+        case INSTR_TAILCALL:
+            prog->argc = st->o2.u1;
+            if(!OPA->function || OPA->function >= (qcint_t)prog->functions.size())
+            {
+                qcvmerror(prog, "CALL outside the program in `%s`", prog->filename.c_str());
+                goto cleanup;
+            }
+
+            newf = &prog->functions[OPA->function];
+            newf->profile++;
+
+            if (newf->entry < 0)
+            {
+                /* a builtin returns right away, and so do we */
+                qcint_t builtinnumber = -newf->entry;
+                prog->statement = (st - &prog->code[0]) + 1;
+                if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
+                    prog->builtins[builtinnumber](prog);
+                else
+                    qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                              builtinnumber, prog->filename.c_str());
+                if (prog->vmerror)
+                    goto cleanup;
+                st = &prog->code[0] + prog_leavefunction(prog);
+                if (prog->stack.empty())
+                    goto cleanup;
+                break;
+            }
+
+            /* frames replaced this way never pile up, count them like jumps */
+            st = &prog->code[0] + prog_tailcallfunction(prog, newf) - 1; /* offset st++ */
+            if (++jumpcount >= maxjumps)
+                qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename.c_str(), jumpcount);
+            break;
+
         case INSTR_STATE:
         {
             qcfloat_t *nextthink;
@@ -1616,9 +3221,78 @@ while (prog->vmerror == 0) {
         case INSTR_BITOR:
             OPC->_float = ((int)OPA->_float) | ((int)OPB->_float);
             break;
+
+        /* the extended instructions read their operands first as the
+         * output may overlap them */
+        case INSTR_BITXOR:
+            OPC->_float = ((int)OPA->_float) ^ ((int)OPB->_float);
+            break;
+        case INSTR_BITAND_V:
+        case INSTR_BITAND_VF:
+        case INSTR_BITOR_V:
+        case INSTR_BITOR_VF:
+        case INSTR_BITXOR_V:
+        case INSTR_BITXOR_VF:
+        {
+            bool scalar = st->opcode == INSTR_BITAND_VF ||
+                          st->opcode == INSTR_BITOR_VF  ||
+                          st->opcode == INSTR_BITXOR_VF;
+            int a[3], b[3], i;
+            for (i = 0; i < 3; ++i) {
+                a[i] = (int)OPA->vector[i];
+                b[i] = (int)(scalar ? OPB->_float : OPB->vector[i]);
+            }
+            for (i = 0; i < 3; ++i) {
+                if (st->opcode == INSTR_BITAND_V || st->opcode == INSTR_BITAND_VF)
+                    OPC->vector[i] = a[i] & b[i];
+                else if (st->opcode == INSTR_BITOR_V || st->opcode == INSTR_BITOR_VF)
+                    OPC->vector[i] = a[i] | b[i];
+                else
+                    OPC->vector[i] = a[i] ^ b[i];
+            }
+            break;
+        }
+        case INSTR_CROSS:
+        {
+            qcfloat_t a[3] = { OPA->vector[0], OPA->vector[1], OPA->vector[2] };
+            qcfloat_t b[3] = { OPB->vector[0], OPB->vector[1], OPB->vector[2] };
+            OPC->vector[0] = a[1] * b[2] - a[2] * b[1];
+            OPC->vector[1] = a[2] * b[0] - a[0] * b[2];
+            OPC->vector[2] = a[0] * b[1] - a[1] * b[0];
+            break;
+        }
+
+        case INSTR_LOADA_F:
+            if (!(ptr = prog_global_index(prog, st->o1.u1, OPB->_float, 1)))
+                goto cleanup;
+            OPC->_int = ptr->_int;
+            break;
+        case INSTR_LOADA_V:
+        {
+            qcint_t v[3];
+            if (!(ptr = prog_global_index(prog, st->o1.u1, OPB->_float, 3)))
+                goto cleanup;
+            v[0] = ptr->ivector[0]; v[1] = ptr->ivector[1]; v[2] = ptr->ivector[2];
+            OPC->ivector[0] = v[0]; OPC->ivector[1] = v[1]; OPC->ivector[2] = v[2];
+            break;
+        }
+        case INSTR_STOREA_F:
+            if (!(ptr = prog_global_index(prog, st->o2.u1, OPC->_float, 1)))
+                goto cleanup;
+            ptr->_int = OPA->_int;
+            break;
+        case INSTR_STOREA_V:
+        {
+            qcint_t v[3] = { OPA->ivector[0], OPA->ivector[1], OPA->ivector[2] };
+            if (!(ptr = prog_global_index(prog, st->o2.u1, OPC->_float, 3)))
+                goto cleanup;
+            ptr->ivector[0] = v[0]; ptr->ivector[1] = v[1]; ptr->ivector[2] = v[2];
+            break;
+        }
     }
 }
 
 #undef QCVM_PROFILE
 #undef QCVM_TRACE
+#undef QCVM_CHECKED
 #endif /* !QCVM_LOOP */
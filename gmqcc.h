@@ -11,6 +11,8 @@ using std::move;
 #include <stdio.h>
 #include <time.h>
 
+#include "qcrt.h"
+
 #define GMQCC_VERSION_MAJOR 0
 #define GMQCC_VERSION_MINOR 3
 #define GMQCC_VERSION_PATCH 6
@@ -460,6 +462,25 @@ enum {
     INSTR_BITAND,
     INSTR_BITOR,
 
+    /*
+     * Extended instructions, only emitted for -target=gmqcc-ext.
+     * The bit operations and CROSS are in the same order as the
+     * emulated instructions they replace.
+     */
+    INSTR_BITAND_V,
+    INSTR_BITAND_VF,
+    INSTR_BITOR_V,
+    INSTR_BITOR_VF,
+    INSTR_BITXOR,
+    INSTR_BITXOR_V,
+    INSTR_BITXOR_VF,
+    INSTR_CROSS,
+    INSTR_LOADA_F,  /* o3 = (&o1)[o2], o2 being a float index */
+    INSTR_LOADA_V,
+    INSTR_STOREA_F, /* (&o2)[o3] = o1, o3 being a float index */
+    INSTR_STOREA_V,
+    INSTR_TAILCALL, /* CALL o1 with o2 arguments in place of the current call */
+
     /*
      * Virtual instructions used by the IR
      * Keep at the end!
@@ -584,6 +605,21 @@ int  con_vout  (const char *, va_list);
 int  con_err   (const char *, ...);
 int  con_out   (const char *, ...);
 
+/*
+ * Output and compile_* counts of a thread held back by con_capture, to be
+ * passed on in a deterministic order with con_replay.
+ */
+struct con_capture_t {
+    std::vector<std::pair<bool, std::string>> chunks; /* to stderr, text */
+    size_t    errors   = 0;
+    size_t    warnings = 0;
+    size_t    Werrors  = 0;
+    lex_ctx_t first_werror;
+};
+
+void con_capture(con_capture_t *); /* for the calling thread, nullptr to stop */
+void con_replay (const con_capture_t &);
+
 /* error/warning interface */
 extern size_t compile_errors;
 extern size_t compile_Werrors;
@@ -669,6 +705,29 @@ struct qc_exec_stack_t {
     prog_section_function_t *function;
 };
 
+/*
+ * Snapshots share unmodified pages of the mutable sections with each
+ * other and with the program, a page being QCVM_PAGE_SIZE elements.
+ */
+#define QCVM_PAGE_BITS 10
+#define QCVM_PAGE_SIZE (1 << QCVM_PAGE_BITS)
+
+/* entities are allocated in chunks of this many, which never move */
+#define QCVM_ENTITY_CHUNK_BITS QCRT_ENTITY_CHUNK_BITS
+#define QCVM_ENTITY_CHUNK      (1 << QCVM_ENTITY_CHUNK_BITS)
+
+typedef std::shared_ptr<std::vector<qcint_t>> qc_page_t;
+
+struct qc_snapshot_t {
+    size_t strings_count;
+    size_t tempstring_at;
+    qcint_t entities;
+    std::vector<qc_page_t> globals;
+    std::vector<qc_page_t> entitychunks;
+    std::vector<char> strings; /* the tempstring area */
+    std::vector<bool> entitypool;
+};
+
 struct qc_program {
     qc_program() = delete;
     qc_program(const char *name, uint16_t crc, size_t entfields);
@@ -680,7 +739,7 @@ struct qc_program {
     std::vector<prog_section_function_t> functions;
     std::vector<char> strings;
     std::vector<qcint_t> globals;
-    std::vector<qcint_t> entitydata;
+    std::vector<std::unique_ptr<qcint_t[]>> entitychunks;
     std::vector<bool> entitypool;
 
     std::vector<const char*> function_stack;
@@ -693,6 +752,7 @@ struct qc_program {
     qcint_t  vmerror;
 
     std::vector<size_t> profile;
+    std::vector<size_t> profile_jumps; /* times each IF/IFNOT jumped */
 
     prog_builtin_t *builtins;
     size_t          builtins_count;
@@ -723,16 +783,40 @@ struct qc_program {
     } cached_globals;
 
     bool supports_state; /* is INSTR_STATE supported? */
+    bool verified;       /* did prog_verify pass? */
+
+    FILE *out;           /* where print and traces go, stdout by default */
+
+    /*
+     * the snapshot page each page of the globals and each entity chunk
+     * was last copied from or to, entity pages are reset on writes
+     */
+    std::vector<qc_page_t> globalpages;
+    std::vector<qc_page_t> entitypages;
+
+    /*
+     * functions compiled to C by gmqcc -emit-c, indexed like functions,
+     * and the state the generated code works on
+     */
+    std::vector<qcrt_function_t> natives;
+    std::vector<qcint_t*> nativechunks;
+    qcrt_t rt;
+    void *nativehandle;
 };
 
 qc_program_t*       prog_load      (const char *filename, bool ignoreversion);
 void                prog_delete    (qc_program_t *prog);
+bool                prog_verify    (qc_program_t *prog);
+bool                prog_load_native(qc_program_t *prog, const char *filename);
 bool                prog_exec      (qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps);
 const char*         prog_getstring (qc_program_t *prog, qcint_t str);
 prog_section_def_t* prog_entfield  (qc_program_t *prog, qcint_t off);
 prog_section_def_t* prog_getdef    (qc_program_t *prog, qcint_t off);
 qcany_t*            prog_getedict  (qc_program_t *prog, qcint_t e);
 qcint_t             prog_tempstring(qc_program_t *prog, const char *_str);
+qc_snapshot_t*      prog_snapshot  (qc_program_t *prog);
+void                prog_restore   (qc_program_t *prog, const qc_snapshot_t *snap);
+void                prog_snapshot_delete(qc_snapshot_t *snap);
 
 
 /* parser.c */
@@ -753,6 +837,13 @@ void ftepp_flush(ftepp_t *ftepp);
 void ftepp_add_define(ftepp_t *ftepp, const char *source, const char *name);
 void ftepp_add_macro(ftepp_t *ftepp, const char *name,   const char *value);
 
+/* profile.c */
+bool     profile_load  (const char *filename);
+void     profile_clear (void);
+bool     profile_branch(const char *function, size_t line, size_t column, uint64_t *ontrue, uint64_t *onfalse);
+uint64_t profile_calls (const char *function);
+uint64_t profile_line  (const char *function, size_t line);
+
 /* main.c */
 
 #if 1
@@ -831,7 +922,7 @@ extern const opts_flag_def_t opts_flag_list[COUNT_FLAGS+1];
 extern const opts_flag_def_t opts_warn_list[COUNT_WARNINGS+1];
 extern const opts_flag_def_t opts_opt_list[COUNT_OPTIMIZATIONS+1];
 extern const unsigned int    opts_opt_oflag[COUNT_OPTIMIZATIONS+1];
-extern unsigned int          opts_optimizationcount[COUNT_OPTIMIZATIONS];
+extern thread_local unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
 
 /* other options: */
 enum {
@@ -841,6 +932,11 @@ enum {
     COMPILER_GMQCC    /* this   QuakeC */
 };
 
+enum {
+    TARGET_STANDARD,  /* instructions every engine implements */
+    TARGET_GMQCC_EXT  /* the extended instructions of qcvm    */
+};
+
 struct opt_value_t {
     union {
         bool b;
@@ -1,6 +1,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "gmqcc.h"
 #include "ir.h"
 
@@ -191,6 +204,7 @@ const uint16_t type_not_instr[TYPE_COUNT] = {
 
 /* protos */
 static void            ir_function_dump(ir_function*, char *ind, int (*oprintf)(const char*,...));
+static ir_value*       ir_value_literal(qc_type vtype);
 
 static ir_value*       ir_block_create_general_instr(ir_block *self, lex_ctx_t, const char *label,
                                                      int op, ir_value *a, ir_value *b, qc_type outype);
@@ -198,6 +212,10 @@ static bool GMQCC_WARN ir_block_create_store(ir_block*, lex_ctx_t, ir_value *tar
 static void            ir_block_dump(ir_block*, char *ind, int (*oprintf)(const char*,...));
 
 static bool            ir_instr_op(ir_instr*, int op, ir_value *value, bool writing);
+static void            ir_op_read_write(int op, size_t *read, size_t *write);
+static void            ir_function_block_order(ir_function*, std::vector<ir_block *> &order);
+template<typename TRANSFER>
+static void            ir_function_solve_dataflow(ir_function*, bool backward, TRANSFER transfer);
 static void            ir_instr_dump(ir_instr* in, char *ind, int (*oprintf)(const char*,...));
 /* error functions */
 
@@ -223,7 +241,7 @@ static bool GMQCC_WARN irwarning(lex_ctx_t ctx, int warntype, const char *fmt, .
  * Vector utility functions
  */
 
-static bool GMQCC_WARN vec_ir_value_find(std::vector<ir_value *> &vec, const ir_value *what, size_t *idx)
+static bool GMQCC_WARN vec_ir_value_find(ir_small_vector<ir_value *, 2> &vec, const ir_value *what, size_t *idx)
 {
     for (auto &it : vec) {
         if (it != what)
@@ -235,7 +253,7 @@ static bool GMQCC_WARN vec_ir_value_find(std::vector<ir_value *> &vec, const ir_
     return false;
 }
 
-static bool GMQCC_WARN vec_ir_block_find(std::vector<ir_block *> &vec, ir_block *what, size_t *idx)
+static bool GMQCC_WARN vec_ir_block_find(ir_small_vector<ir_block *, 2> &vec, ir_block *what, size_t *idx)
 {
     for (auto &it : vec) {
         if (it != what)
@@ -247,7 +265,7 @@ static bool GMQCC_WARN vec_ir_block_find(std::vector<ir_block *> &vec, ir_block
     return false;
 }
 
-static bool GMQCC_WARN vec_ir_instr_find(std::vector<ir_instr *> &vec, ir_instr *what, size_t *idx)
+static bool GMQCC_WARN vec_ir_instr_find(ir_small_vector<ir_instr *, 2> &vec, ir_instr *what, size_t *idx)
 {
     for (auto &it : vec) {
         if (it != what)
@@ -259,6 +277,75 @@ static bool GMQCC_WARN vec_ir_instr_find(std::vector<ir_instr *> &vec, ir_instr
     return false;
 }
 
+/*
+ * Functions are finalized on several threads at once, sharing nothing but
+ * the builder's globals.  Their lists of reading and writing instructions
+ * and their members only change under this lock.
+ */
+static std::mutex ir_globals_lock;
+
+static void ir_value_add_use(ir_small_vector<ir_instr *, 2> &uses, ir_value *v, ir_instr *in)
+{
+    std::unique_lock<std::mutex> lock(ir_globals_lock, std::defer_lock);
+    if (v->m_store == store_global)
+        lock.lock();
+    uses.push_back(in);
+}
+
+static bool ir_value_remove_use(ir_small_vector<ir_instr *, 2> &uses, ir_value *v, ir_instr *in)
+{
+    std::unique_lock<std::mutex> lock(ir_globals_lock, std::defer_lock);
+    size_t idx;
+    if (v->m_store == store_global)
+        lock.lock();
+    if (!vec_ir_instr_find(uses, in, &idx))
+        return false;
+    uses.erase(uses.begin() + idx);
+    return true;
+}
+
+/***********************************************************************
+ * IR Arena
+ */
+
+thread_local ir_arena *ir_arena::current = nullptr;
+
+ir_arena::~ir_arena()
+{
+    for (auto &it : m_chunks)
+        mem_d(it);
+    if (current == this)
+        current = nullptr;
+}
+
+void *ir_arena::allocate(size_t bytes)
+{
+    size_t size = (bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (size < IR_ARENA_MAX_SIZE && m_free[size / sizeof(void*)]) {
+        slot *s = m_free[size / sizeof(void*)];
+        m_free[size / sizeof(void*)] = s->next;
+        return s;
+    }
+    if (size > (size_t)(m_end - m_top)) {
+        size_t chunk = std::max((size_t)IR_ARENA_CHUNK, size);
+        m_top = (char*)mem_a(chunk);
+        m_end = m_top + chunk;
+        m_chunks.push_back(m_top);
+    }
+    m_top += size;
+    return m_top - size;
+}
+
+void ir_arena::release(void *ptr, size_t bytes)
+{
+    size_t size = (bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (size < IR_ARENA_MAX_SIZE) {
+        slot *s = (slot*)ptr;
+        s->next = m_free[size / sizeof(void*)];
+        m_free[size / sizeof(void*)] = s;
+    }
+}
+
 /***********************************************************************
  * IR Builder
  */
@@ -271,6 +358,7 @@ ir_builder::ir_builder(const std::string& modulename)
 : m_name(modulename),
   m_code(new code_t)
 {
+    ir_arena::current = &m_arena;
     m_htglobals   = util_htnew(IR_HT_SIZE);
     m_htfields    = util_htnew(IR_HT_SIZE);
     m_htfunctions = util_htnew(IR_HT_SIZE);
@@ -428,207 +516,2158 @@ static bool instr_is_operation(uint16_t op)
              (op >= VINSTR_BITAND_V && op <= VINSTR_NEG_V) );
 }
 
-static bool ir_function_pass_peephole(ir_function *self)
+/*
+ * Numbers the blocks, puts the reachable ones in reverse post-order and
+ * finds their immediate dominators by that order, (size_t)-1 for the
+ * unreachable ones.  position maps a block's m_eid into the order.
+ */
+static void ir_function_dominators(ir_function *self, std::vector<ir_block*> &order,
+                                   std::vector<size_t> &position, std::vector<size_t> &idom)
 {
-    for (auto& bp : self->m_blocks) {
-        ir_block *block = bp.get();
-        for (size_t i = 0; i < block->m_instr.size(); ++i) {
-            ir_instr *inst;
-            inst = block->m_instr[i];
+    bool changed = true;
 
-            if (i >= 1 &&
-                (inst->m_opcode >= INSTR_STORE_F &&
-                 inst->m_opcode <= INSTR_STORE_FNC))
-            {
-                ir_instr *store;
-                ir_instr *oper;
-                ir_value *value;
+    for (size_t i = 0; i < self->m_blocks.size(); ++i)
+        self->m_blocks[i]->m_eid = i;
+    ir_function_block_order(self, order);
 
-                store = inst;
+    position.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        position[order[i]->m_eid] = i;
 
-                oper  = block->m_instr[i-1];
-                if (!instr_is_operation(oper->m_opcode))
+    idom.assign(order.size(), (size_t)-1);
+    idom[0] = 0;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            size_t dom = (size_t)-1;
+            for (auto &e : order[i]->m_entries) {
+                size_t p = position[e->m_eid];
+                if (idom[p] == (size_t)-1)
+                    continue;
+                if (dom == (size_t)-1) {
+                    dom = p;
                     continue;
-
-                /* Don't change semantics of MUL_VF in engines where these may not alias. */
-                if (OPTS_FLAG(LEGACY_VECTOR_MATHS)) {
-                    if (oper->m_opcode == INSTR_MUL_VF && oper->_m_ops[2]->m_memberof == oper->_m_ops[1])
-                        continue;
-                    if (oper->m_opcode == INSTR_MUL_FV && oper->_m_ops[1]->m_memberof == oper->_m_ops[2])
-                        continue;
                 }
+                while (dom != p) {
+                    while (dom > p)
+                        dom = idom[dom];
+                    while (p > dom)
+                        p = idom[p];
+                }
+            }
+            if (dom != idom[i]) {
+                idom[i] = dom;
+                changed = true;
+            }
+        }
+    }
+}
 
-                value = oper->_m_ops[0];
-
-                /* only do it for SSA values */
-                if (value->m_store != store_value)
-                    continue;
+/* deletes an instruction, which also has to leave the writes of its output */
+static void ir_instr_remove(ir_instr *in)
+{
+    size_t read, write;
+    ir_op_read_write(in->m_opcode, &read, &write);
+    if ((write & 1) && in->m_opcode != INSTR_STATE)
+        (void)!ir_instr_op(in, 0, nullptr, true);
+    delete in;
+}
 
-                /* don't optimize out the temp if it's used later again */
-                if (value->m_reads.size() != 1)
-                    continue;
+/*
+ * Common subexpression elimination.  Operations on values which cannot
+ * change once computed (constants, fields, temporaries and locals which
+ * are never written, or only once at the top of the function) are
+ * numbered over the dominator tree.  Operations
+ * reading other locals or globals, entity fields or string contents are
+ * only reused within their block, until something may have changed what
+ * they read: a write to an operand, a call, STATE or indexed store, or a
+ * STOREP to the same field.
+ */
+typedef std::tuple<int, ir_value*, ir_value*> ir_cse_key;
+typedef std::map<ir_cse_key, ir_value*>        ir_cse_map;
+
+struct ir_cse_state {
+    ir_builder  *owner;
+    ir_block    *entry;
+    ir_cse_map   dominated;
+    /* locals written once by the entry block, and those written so far */
+    std::unordered_set<ir_value*> once;
+    std::unordered_set<ir_value*> assigned;
+};
 
-                /* The very next store must use this value */
-                if (value->m_reads[0] != store)
-                    continue;
+static ir_value *ir_value_root(ir_value *v)
+{
+    return v->m_memberof ? v->m_memberof : v;
+}
 
-                /* And of course the store must _read_ from it, so it's in
-                 * OP 1 */
-                if (store->_m_ops[1] != value)
-                    continue;
+static size_t ir_value_write_count(ir_value *v)
+{
+    size_t count = v->m_writes.size();
+    for (size_t m = 0; m < 3; ++m) {
+        if (v->m_members[m])
+            count += v->m_members[m]->m_writes.size();
+    }
+    return count;
+}
 
-                ++opts_optimizationcount[OPTIM_PEEPHOLE];
-                (void)!ir_instr_op(oper, 0, store->_m_ops[0], true);
+/* the operands an instruction reads as a mask, STATE reading both of its own */
+static size_t ir_instr_read_mask(ir_instr *in)
+{
+    size_t read, write;
+    if (in->m_opcode == INSTR_STATE)
+        return 3;
+    ir_op_read_write(in->m_opcode, &read, &write);
+    return read;
+}
 
-                block->m_instr.erase(block->m_instr.begin() + i);
-                delete store;
-            }
-            else if (inst->m_opcode == VINSTR_COND)
-            {
-                /* COND on a value resulting from a NOT could
-                 * remove the NOT and swap its operands
-                 */
-                while (true) {
-                    ir_block *tmp;
-                    size_t    inotid;
-                    ir_instr *inot;
-                    ir_value *value;
-                    value = inst->_m_ops[0];
+/* the value an instruction writes, if any */
+static ir_value *ir_instr_written(ir_instr *in)
+{
+    size_t read, write;
+    ir_op_read_write(in->m_opcode, &read, &write);
+    if (!(write & 1) || in->m_opcode == INSTR_STATE)
+        return nullptr;
+    return in->_m_ops[0];
+}
 
-                    if (value->m_store != store_value || value->m_reads.size() != 1 || value->m_reads[0] != inst)
-                        break;
+/* a field declared with .type, not a global holding one */
+static bool ir_value_is_field(ir_builder *owner, ir_value *v)
+{
+    v = ir_value_root(v);
+    return v->m_store == store_global && v->m_vtype == TYPE_FIELD &&
+           util_htget(owner->m_htfields, v->m_name.c_str()) == v;
+}
 
-                    inot = value->m_writes[0];
-                    if (inot->_m_ops[0] != value ||
-                        inot->m_opcode < INSTR_NOT_F ||
-                        inot->m_opcode > INSTR_NOT_FNC ||
-                        inot->m_opcode == INSTR_NOT_V || /* can't do these */
-                        inot->m_opcode == INSTR_NOT_S)
-                    {
-                        break;
-                    }
+static bool ir_value_is_stable(ir_cse_state &state, ir_block *at, ir_value *v)
+{
+    if (!v)
+        return true;
+    v = ir_value_root(v);
+    if (v->m_hasvalue && v->m_cvq == CV_CONST)
+        return true;
+    switch (v->m_store) {
+        case store_value:
+            return ir_value_write_count(v) == 1;
+        case store_local:
+        case store_param:
+            if (state.once.count(v))
+                return at != state.entry || state.assigned.count(v);
+            return ir_value_write_count(v) == 0;
+        case store_global:
+            return ir_value_is_field(state.owner, v);
+        default:
+            return false;
+    }
+}
 
-                    /* count */
-                    ++opts_optimizationcount[OPTIM_PEEPHOLE];
-                    /* change operand */
-                    (void)!ir_instr_op(inst, 0, inot->_m_ops[1], false);
-                    /* remove NOT */
-                    tmp = inot->m_owner;
-                    for (inotid = 0; inotid < tmp->m_instr.size(); ++inotid) {
-                        if (tmp->m_instr[inotid] == inot)
-                            break;
-                    }
-                    if (inotid >= tmp->m_instr.size()) {
-                        compile_error(inst->m_context, "sanity-check failed: failed to find instruction to optimize out");
-                        return false;
-                    }
-                    tmp->m_instr.erase(tmp->m_instr.begin() + inotid);
-                    delete inot;
-                    /* swap ontrue/onfalse */
-                    tmp = inst->m_bops[0];
-                    inst->m_bops[0] = inst->m_bops[1];
-                    inst->m_bops[1] = tmp;
-                }
-                continue;
-            }
-        }
+static bool ir_cse_commutative(int op)
+{
+    switch (op) {
+        case INSTR_MUL_F:   case INSTR_MUL_V:
+        case INSTR_ADD_F:   case INSTR_ADD_V:
+        case INSTR_EQ_F:    case INSTR_EQ_V:  case INSTR_EQ_S:
+        case INSTR_EQ_E:    case INSTR_EQ_FNC:
+        case INSTR_NE_F:    case INSTR_NE_V:  case INSTR_NE_S:
+        case INSTR_NE_E:    case INSTR_NE_FNC:
+        case INSTR_AND:     case INSTR_OR:
+        case INSTR_BITAND:  case INSTR_BITOR:
+        case VINSTR_BITAND_V: case VINSTR_BITOR_V:
+        case VINSTR_BITXOR:   case VINSTR_BITXOR_V:
+            return true;
+        default:
+            return false;
     }
+}
 
-    return true;
+/* operations whose result depends on more than their operands */
+static bool ir_cse_reads_memory(int op)
+{
+    return (op >= INSTR_LOAD_F && op <= INSTR_LOAD_FNC) ||
+           op == INSTR_EQ_S || op == INSTR_NE_S || op == INSTR_NOT_S;
 }
 
-static bool ir_function_pass_tailrecursion(ir_function *self)
+template<typename PRED>
+static void ir_cse_forget(ir_cse_map &map, PRED pred)
 {
-    size_t p;
+    for (auto it = map.begin(); it != map.end(); ) {
+        if (pred(it->first))
+            it = map.erase(it);
+        else
+            ++it;
+    }
+}
 
-    for (auto& bp : self->m_blocks) {
-        ir_block *block = bp.get();
+static void ir_value_replace_reads(ir_value *from, ir_value *to)
+{
+    ir_small_vector<ir_instr*, 2> reads = from->m_reads;
+    for (auto &in : reads) {
+        for (size_t o = 0; o < 3; ++o) {
+            if (in->_m_ops[o] == from)
+                (void)!ir_instr_op(in, o, to, false);
+        }
+        for (auto &pe : in->m_phi) {
+            if (pe.value == from) {
+                pe.value = to;
+                ir_value_add_use(to->m_reads, to, in);
+            }
+        }
+        for (auto &p : in->m_params) {
+            if (p == from) {
+                p = to;
+                ir_value_add_use(to->m_reads, to, in);
+            }
+        }
+    }
+    from->m_reads.clear();
 
-        ir_value *funcval;
-        ir_instr *ret, *call, *store = nullptr;
+    for (size_t m = 0; m < 3; ++m) {
+        if (from->m_members[m] && !from->m_members[m]->m_reads.empty())
+            ir_value_replace_reads(from->m_members[m], to->vectorMember(m));
+    }
+}
 
-        if (!block->m_final || block->m_instr.size() < 2)
-            continue;
+static void ir_block_cse(ir_block *self, ir_cse_state &state, std::vector<ir_cse_key> &added)
+{
+    ir_builder *owner = state.owner;
+    ir_cse_map  local;
 
-        ret = block->m_instr.back();
-        if (ret->m_opcode != INSTR_DONE && ret->m_opcode != INSTR_RETURN)
-            continue;
+    for (size_t i = 0; i < self->m_instr.size(); ++i) {
+        ir_instr *in  = self->m_instr[i];
+        ir_value *out = in->_m_ops[0];
+        int       op  = in->m_opcode;
+        size_t    read, write;
 
-        call = block->m_instr[block->m_instr.size()-2];
-        if (call->m_opcode >= INSTR_STORE_F && call->m_opcode <= INSTR_STORE_FNC) {
-            /* account for the unoptimized
-             * CALL
-             * STORE %return, %tmp
-             * RETURN %tmp
-             * version
-             */
-            if (block->m_instr.size() < 3)
+        if (instr_is_operation(op) && (op < INSTR_CALL0 || op > INSTR_CALL8) &&
+            out && out->m_store == store_value && ir_value_write_count(out) == 1)
+        {
+            ir_value *a = in->_m_ops[1];
+            ir_value *b = in->_m_ops[2];
+            bool      stable;
+
+            if (ir_cse_commutative(op) && std::less<ir_value*>()(b, a))
+                std::swap(a, b);
+            ir_cse_key key(op, a, b);
+
+            stable = !ir_cse_reads_memory(op) && ir_value_is_stable(state, self, a) &&
+                     ir_value_is_stable(state, self, b);
+            ir_cse_map &map = stable ? state.dominated : local;
+            auto it = map.find(key);
+            if (it == map.end()) {
+                map[key] = out;
+                if (stable)
+                    added.push_back(key);
                 continue;
+            }
 
-            store = call;
-            call = block->m_instr[block->m_instr.size()-3];
-        }
-
-        if (call->m_opcode < INSTR_CALL0 || call->m_opcode > INSTR_CALL8)
+            ++opts_optimizationcount[OPTIM_CSE];
+            ir_value_replace_reads(out, it->second);
+            ir_instr_remove(in);
+            self->m_instr.erase(self->m_instr.begin() + i--);
             continue;
+        }
 
-        if (store) {
-            /* optimize out the STORE */
-            if (ret->_m_ops[0]   &&
-                ret->_m_ops[0]   == store->_m_ops[0] &&
-                store->_m_ops[1] == call->_m_ops[0])
+        if ((op >= INSTR_CALL0 && op <= INSTR_CALL8) || op == VINSTR_NRCALL || op == INSTR_STATE ||
+            op == INSTR_STOREA_F || op == INSTR_STOREA_V)
+        {
+            ir_cse_forget(local, [&](const ir_cse_key &k) {
+                ir_value *a = std::get<1>(k), *b = std::get<2>(k);
+                return ir_cse_reads_memory(std::get<0>(k)) ||
+                       (a && ir_value_root(a)->m_store == store_global) ||
+                       (b && ir_value_root(b)->m_store == store_global);
+            });
+        }
+        else if (op >= INSTR_STOREP_F && op <= INSTR_STOREP_FNC) {
+            /* a pointer made by ADDRESS tells which field it writes */
+            ir_value *ptr   = in->_m_ops[0];
+            ir_value *field = nullptr;
+            if (ptr->m_store == store_value && ptr->m_writes.size() == 1 &&
+                ptr->m_writes[0]->m_opcode == INSTR_ADDRESS &&
+                ir_value_is_field(owner, ptr->m_writes[0]->_m_ops[2]))
             {
-                ++opts_optimizationcount[OPTIM_PEEPHOLE];
-                call->_m_ops[0] = store->_m_ops[0];
-                block->m_instr.erase(block->m_instr.end()-2);
-                delete store;
+                field = ir_value_root(ptr->m_writes[0]->_m_ops[2]);
             }
-            else
-                continue;
+            ir_cse_forget(local, [&](const ir_cse_key &k) {
+                ir_value *f = std::get<2>(k);
+                if (std::get<0>(k) < INSTR_LOAD_F || std::get<0>(k) > INSTR_LOAD_FNC)
+                    return false;
+                return !field || !ir_value_is_field(owner, f) || ir_value_root(f) == field;
+            });
         }
 
-        if (!call->_m_ops[0])
-            continue;
-
-        funcval = call->_m_ops[1];
-        if (!funcval)
-            continue;
-        if (funcval->m_vtype != TYPE_FUNCTION || funcval->m_constval.vfunc != self)
-            continue;
-
-        /* now we have a CALL and a RET, check if it's a tailcall */
-        if (ret->_m_ops[0] && call->_m_ops[0] != ret->_m_ops[0])
-            continue;
+        ir_op_read_write(op, &read, &write);
+        if (out && (write & 1) && op != INSTR_STATE) {
+            ir_value *root = ir_value_root(out);
+            ir_cse_forget(local, [&](const ir_cse_key &k) {
+                ir_value *a = std::get<1>(k), *b = std::get<2>(k);
+                return (a && ir_value_root(a) == root) || (b && ir_value_root(b) == root);
+            });
+            if (self == state.entry && state.once.count(root))
+                state.assigned.insert(root);
+        }
+    }
+}
 
-        ++opts_optimizationcount[OPTIM_TAIL_RECURSION];
-        block->m_instr.erase(block->m_instr.end()-2, block->m_instr.end());
+static bool ir_function_pass_cse(ir_function *self)
+{
+    std::vector<ir_block*>           order;
+    std::vector<size_t>              position, idom;
+    std::vector<std::vector<size_t>> children;
+    ir_cse_state                     state;
+
+    struct frame {
+        size_t                  block;
+        size_t                  child;
+        std::vector<ir_cse_key> added;
+    };
+    std::vector<frame> stack;
 
-        block->m_final = false; /* open it back up */
+    if (self->m_blocks.empty())
+        return true;
 
-        /* emite parameter-stores */
-        for (p = 0; p < call->m_params.size(); ++p) {
-            /* assert(call->params_count <= self->locals_count); */
-            if (!ir_block_create_store(block, call->m_context, self->m_locals[p].get(), call->m_params[p])) {
-                irerror(call->m_context, "failed to create tailcall store instruction for parameter %i", (int)p);
-                return false;
+    state.owner = self->m_owner;
+    state.entry = self->m_blocks[0].get();
+    if (state.entry->m_entries.empty()) {
+        for (auto& lp : self->m_locals) {
+            ir_value *v = lp.get();
+            if (ir_value_write_count(v) != 1)
+                continue;
+            ir_instr *w = v->m_writes.size() ? v->m_writes[0] : nullptr;
+            for (size_t m = 0; !w && m < 3; ++m) {
+                if (v->m_members[m] && v->m_members[m]->m_writes.size())
+                    w = v->m_members[m]->m_writes[0];
             }
+            if (w->m_owner == state.entry)
+                state.once.insert(v);
         }
-        if (!ir_block_create_jump(block, call->m_context, self->m_blocks[0].get())) {
-            irerror(call->m_context, "failed to create tailcall jump");
-            return false;
-        }
+    }
 
-        delete call;
-        delete ret;
+    ir_function_dominators(self, order, position, idom);
+
+    /* unreachable blocks are left alone */
+    children.resize(order.size());
+    for (size_t i = 1; i < order.size(); ++i) {
+        if (idom[i] != (size_t)-1)
+            children[idom[i]].push_back(i);
     }
 
+    stack.push_back(frame{0, 0, {}});
+    ir_block_cse(order[0], state, stack.back().added);
+    while (!stack.empty()) {
+        frame &f = stack.back();
+        if (f.child < children[f.block].size()) {
+            size_t c = children[f.block][f.child++];
+            stack.push_back(frame{c, 0, {}});
+            ir_block_cse(order[c], state, stack.back().added);
+            continue;
+        }
+        for (auto &k : f.added)
+            state.dominated.erase(k);
+        stack.pop_back();
+    }
     return true;
 }
 
-bool ir_function_finalize(ir_function *self)
-{
-    if (self->m_builtin)
-        return true;
+/*
+ * Loop invariant code motion.  Natural loops are found from the back
+ * edges of the dominator tree and get a preheader, a block outside the
+ * loop which only jumps to its header.  Operations whose operands are
+ * not written inside the loop are moved there, inner loops first, so
+ * their results can move on out of the loops around them.  Globals may
+ * be changed by any call or indexed store, and entity fields by calls,
+ * STATE and STOREP,
+ * so loads and globals only count as invariant in loops without those.
+ * Loads may fail on a bad entity, so they are only moved out of the
+ * blocks running before the loop can be left, which excludes the body of
+ * a loop checking its condition first as it may not run at all.
+ */
+struct ir_loop {
+    ir_block                      *header;
+    ir_block                      *preheader;
+    std::vector<ir_block*>         latches;
+    std::unordered_set<ir_block*>  body;
+    bool                           calls;
+    bool                           stores;
+    std::unordered_set<ir_value*>  globals; /* written inside the loop */
+};
+
+static bool ir_block_dominates(const std::vector<size_t> &idom, size_t a, size_t b)
+{
+    if (idom[b] == (size_t)-1)
+        return false;
+    while (b > a)
+        b = idom[b];
+    return a == b;
+}
+
+static bool ir_block_has_phi(ir_block *self)
+{
+    return !self->m_instr.empty() && self->m_instr[0]->m_opcode == VINSTR_PHI;
+}
+
+/* a block between the entries from outside a loop and its header */
+static void ir_block_create_preheader(ir_block *header, const std::unordered_set<ir_block*> &body)
+{
+    ir_function *func = header->m_owner;
+    ir_block    *pre  = new ir_block(func, header->m_label + "_preheader");
+
+    pre->m_context = header->m_context;
+    func->m_blocks.emplace_back(pre);
+
+    for (size_t i = 0; i < header->m_entries.size(); ++i) {
+        ir_block *from = header->m_entries[i];
+        if (body.count(from))
+            continue;
+        for (auto &to : from->m_exits) {
+            if (to == header)
+                to = pre;
+        }
+        for (auto &b : from->m_instr.back()->m_bops) {
+            if (b == header)
+                b = pre;
+        }
+        pre->m_entries.push_back(from);
+        header->m_entries.erase(header->m_entries.begin() + i--);
+    }
+    (void)!ir_block_create_jump(pre, header->m_context, header);
+}
+
+/* finds the natural loops, the ones without a usable preheader are skipped */
+static void ir_function_find_loops(ir_function *self, std::vector<ir_block*> &order,
+                                   std::vector<size_t> &position, std::vector<size_t> &idom,
+                                   std::vector<ir_loop> &loops)
+{
+    std::unordered_map<ir_block*, size_t> headers;
+
+    loops.clear();
+    ir_function_dominators(self, order, position, idom);
+    for (size_t i = 0; i < order.size() && idom[i] != (size_t)-1; ++i) {
+        for (auto &h : order[i]->m_exits) {
+            if (!ir_block_dominates(idom, position[h->m_eid], i))
+                continue;
+            auto it = headers.find(h);
+            if (it == headers.end()) {
+                it = headers.emplace(h, loops.size()).first;
+                loops.push_back(ir_loop{h, nullptr, {}, {h}, false, false, {}});
+            }
+            loops[it->second].latches.push_back(order[i]);
+        }
+    }
+
+    for (auto &loop : loops) {
+        std::vector<ir_block*> work = loop.latches;
+        while (!work.empty()) {
+            ir_block *b = work.back();
+            work.pop_back();
+            if (!loop.body.insert(b).second)
+                continue;
+            for (auto &e : b->m_entries) {
+                if (idom[position[e->m_eid]] != (size_t)-1)
+                    work.push_back(e);
+            }
+        }
+
+        for (auto &e : loop.header->m_entries) {
+            if (loop.body.count(e))
+                continue;
+            if (loop.preheader || e->m_exits.size() != 1 ||
+                e->m_instr.back()->m_opcode != VINSTR_JUMP)
+            {
+                loop.preheader = nullptr;
+                break;
+            }
+            loop.preheader = e;
+        }
+
+        for (auto &b : loop.body) {
+            for (auto &in : b->m_instr) {
+                int op = in->m_opcode;
+                if ((op >= INSTR_CALL0 && op <= INSTR_CALL8) || op == VINSTR_NRCALL ||
+                    op == INSTR_STOREA_F || op == INSTR_STOREA_V)
+                {
+                    loop.calls = true;
+                }
+                else if ((op >= INSTR_STOREP_F && op <= INSTR_STOREP_FNC) || op == INSTR_STATE)
+                    loop.stores = true;
+                if (ir_instr_written(in) && ir_value_root(in->_m_ops[0])->m_store == store_global)
+                    loop.globals.insert(ir_value_root(in->_m_ops[0]));
+            }
+        }
+    }
+}
+
+static bool ir_value_is_invariant(ir_builder *owner, const ir_loop &loop, ir_value *v)
+{
+    if (!v)
+        return true;
+    v = ir_value_root(v);
+    if ((v->m_hasvalue && v->m_cvq == CV_CONST) || ir_value_is_field(owner, v))
+        return true;
+    if (v->m_store != store_value && v->m_store != store_local && v->m_store != store_param &&
+        (v->m_store != store_global || loop.calls))
+    {
+        return false;
+    }
+    /* other functions use the globals at the same time */
+    if (v->m_store == store_global)
+        return !loop.globals.count(v);
+    for (auto &w : v->m_writes) {
+        if (loop.body.count(w->m_owner))
+            return false;
+    }
+    for (size_t m = 0; m < 3; ++m) {
+        if (!v->m_members[m])
+            continue;
+        for (auto &w : v->m_members[m]->m_writes) {
+            if (loop.body.count(w->m_owner))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void ir_loop_hoist(ir_builder *owner, ir_loop &loop, const std::vector<ir_block*> &order,
+                          const std::vector<size_t> &position, const std::vector<size_t> &idom)
+{
+    ir_block *pre = loop.preheader;
+
+    for (size_t i = position[loop.header->m_eid]; i < order.size(); ++i) {
+        ir_block *block = order[i];
+        bool      every = true;
+
+        if (!loop.body.count(block))
+            continue;
+        /* every block leaving the loop, a zero trip loop leaves by its header */
+        for (auto &b : loop.body) {
+            for (auto &e : b->m_exits) {
+                if (!loop.body.count(e))
+                    every = every && ir_block_dominates(idom, i, position[b->m_eid]);
+            }
+        }
+
+        for (size_t k = 0; k < block->m_instr.size(); ++k) {
+            ir_instr *in  = block->m_instr[k];
+            ir_value *out = in->_m_ops[0];
+            int       op  = in->m_opcode;
+
+            if (!instr_is_operation(op) || (op >= INSTR_CALL0 && op <= INSTR_CALL8) ||
+                op == INSTR_ADDRESS || !out || out->m_store != store_value ||
+                ir_value_write_count(out) != 1)
+            {
+                continue;
+            }
+            if (ir_cse_reads_memory(op) && (loop.calls || loop.stores))
+                continue;
+            if (op >= INSTR_LOAD_F && op <= INSTR_LOAD_FNC && !every)
+                continue;
+            if (!ir_value_is_invariant(owner, loop, in->_m_ops[1]) ||
+                !ir_value_is_invariant(owner, loop, in->_m_ops[2]))
+            {
+                continue;
+            }
+
+            ++opts_optimizationcount[OPTIM_LICM];
+            block->m_instr.erase(block->m_instr.begin() + k--);
+            in->m_owner = pre;
+            pre->m_instr.insert(pre->m_instr.end() - 1, in);
+        }
+    }
+}
+
+static bool ir_function_pass_licm(ir_function *self)
+{
+    std::vector<ir_block*> order;
+    std::vector<size_t>    position, idom;
+    std::vector<ir_loop>   loops;
+    bool                   created = false;
+
+    if (self->m_blocks.empty())
+        return true;
+
+    ir_function_find_loops(self, order, position, idom, loops);
+    for (auto &loop : loops) {
+        if (!loop.preheader && loop.header != self->m_blocks[0].get() &&
+            !ir_block_has_phi(loop.header))
+        {
+            ir_block_create_preheader(loop.header, loop.body);
+            created = true;
+        }
+    }
+    if (created)
+        ir_function_find_loops(self, order, position, idom, loops);
+
+    std::sort(loops.begin(), loops.end(), [](const ir_loop &a, const ir_loop &b) {
+        return a.body.size() < b.body.size();
+    });
+    for (auto &loop : loops) {
+        if (loop.preheader)
+            ir_loop_hoist(self->m_owner, loop, order, position, idom);
+    }
+    return true;
+}
+
+/*
+ * Sparse conditional constant propagation.  Float and vector
+ * temporaries, and locals whose only assignment dominates all their
+ * reads, start out undefined and are lowered to a constant or to
+ * varying while only the blocks reachable under the constants found so
+ * far are evaluated.  Constant results are replaced by immediates,
+ * conditions on constants become jumps and the blocks which were never
+ * reached are deleted.
+ */
+struct ir_sccp_value {
+    enum { UNDEFINED, CONSTANT, VARYING } state;
+    qcfloat_t v[3];
+};
+
+struct ir_sccp_state {
+    std::unordered_map<ir_value*, ir_sccp_value> values;
+    std::unordered_set<ir_block*>                reached;
+    std::set<std::pair<ir_block*, ir_block*>>    edges;
+    bool                                         changed;
+};
+
+static ir_sccp_value ir_sccp_varying()
+{
+    ir_sccp_value r;
+    r.state = ir_sccp_value::VARYING;
+    r.v[0] = r.v[1] = r.v[2] = 0;
+    return r;
+}
+
+static ir_sccp_value ir_sccp_get(ir_sccp_state &state, ir_value *v)
+{
+    ir_sccp_value r;
+    if (!v)
+        return ir_sccp_varying();
+
+    if (v->m_memberof) {
+        r = ir_sccp_get(state, v->m_memberof);
+        if (r.state == ir_sccp_value::CONSTANT) {
+            if (v->m_memberof->m_vtype != TYPE_VECTOR)
+                return ir_sccp_varying();
+            r.v[0] = r.v[v->m_code.addroffset];
+        }
+        return r;
+    }
+
+    if (v->m_hasvalue && v->m_cvq == CV_CONST && v->m_store == store_global) {
+        r.state = ir_sccp_value::CONSTANT;
+        if (v->m_vtype == TYPE_FLOAT)
+            r.v[0] = v->m_constval.vfloat;
+        else if (v->m_vtype == TYPE_VECTOR) {
+            r.v[0] = v->m_constval.vvec.x;
+            r.v[1] = v->m_constval.vvec.y;
+            r.v[2] = v->m_constval.vvec.z;
+        }
+        else
+            r.state = ir_sccp_value::VARYING;
+        return r;
+    }
+
+    auto it = state.values.find(v);
+    if (it == state.values.end())
+        return ir_sccp_varying();
+    return it->second;
+}
+
+static bool ir_sccp_same(const ir_sccp_value &a, const ir_sccp_value &b, size_t count)
+{
+    return !memcmp(a.v, b.v, sizeof(a.v[0]) * count);
+}
+
+/* lowers the value of v to include with */
+static void ir_sccp_set(ir_sccp_state &state, ir_value *v, const ir_sccp_value &with)
+{
+    auto it = state.values.find(v);
+    if (it == state.values.end() || with.state == ir_sccp_value::UNDEFINED)
+        return;
+
+    ir_sccp_value &have = it->second;
+    if (have.state == ir_sccp_value::VARYING)
+        return;
+    if (have.state == ir_sccp_value::CONSTANT && with.state == ir_sccp_value::CONSTANT &&
+        ir_sccp_same(have, with, v->m_vtype == TYPE_VECTOR ? 3 : 1))
+        return;
+
+    if (have.state == ir_sccp_value::UNDEFINED)
+        have = with;
+    else
+        have.state = ir_sccp_value::VARYING;
+    state.changed = true;
+}
+
+static bool ir_sccp_fold(int op, const qcfloat_t *a, const qcfloat_t *b, qcfloat_t *out)
+{
+    out[0] = out[1] = out[2] = 0;
+    switch (op) {
+        case INSTR_MUL_F: out[0] = a[0] * b[0]; break;
+        case INSTR_ADD_F: out[0] = a[0] + b[0]; break;
+        case INSTR_SUB_F: out[0] = a[0] - b[0]; break;
+        case INSTR_DIV_F:
+            /* engines disagree on division by zero */
+            if (b[0] == 0.0f)
+                return false;
+            out[0] = a[0] / b[0];
+            break;
+        case INSTR_MUL_V: out[0] = a[0]*b[0] + a[1]*b[1] + a[2]*b[2]; break;
+        case INSTR_MUL_FV:
+            for (size_t i = 0; i < 3; ++i)
+                out[i] = a[0] * b[i];
+            break;
+        case INSTR_MUL_VF:
+            for (size_t i = 0; i < 3; ++i)
+                out[i] = b[0] * a[i];
+            break;
+        case INSTR_ADD_V:
+            for (size_t i = 0; i < 3; ++i)
+                out[i] = a[i] + b[i];
+            break;
+        case INSTR_SUB_V:
+            for (size_t i = 0; i < 3; ++i)
+                out[i] = a[i] - b[i];
+            break;
+        case INSTR_EQ_F: out[0] = (a[0] == b[0]); break;
+        case INSTR_NE_F: out[0] = (a[0] != b[0]); break;
+        case INSTR_LE:   out[0] = (a[0] <= b[0]); break;
+        case INSTR_GE:   out[0] = (a[0] >= b[0]); break;
+        case INSTR_LT:   out[0] = (a[0] <  b[0]); break;
+        case INSTR_GT:   out[0] = (a[0] >  b[0]); break;
+        case INSTR_EQ_V:
+            out[0] = (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]);
+            break;
+        case INSTR_NE_V:
+            out[0] = (a[0] != b[0] || a[1] != b[1] || a[2] != b[2]);
+            break;
+        case INSTR_NOT_F: out[0] = !a[0]; break;
+        case INSTR_NOT_V: out[0] = !a[0] && !a[1] && !a[2]; break;
+        default:
+            return false;
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        if (!std::isfinite(out[i]))
+            return false;
+    }
+    return true;
+}
+
+static void ir_sccp_reach(ir_sccp_state &state, ir_block *from, ir_block *to)
+{
+    if (state.edges.insert(std::make_pair(from, to)).second)
+        state.changed = true;
+    if (state.reached.insert(to).second)
+        state.changed = true;
+}
+
+static bool ir_sccp_true(const ir_sccp_value &cond)
+{
+    int32_t bits;
+    memcpy(&bits, &cond.v[0], sizeof(bits));
+    return (bits & 0x7FFFFFFF) != 0;
+}
+
+static void ir_block_sccp(ir_block *self, ir_sccp_state &state, bool settle)
+{
+    for (auto &in : self->m_instr) {
+        ir_value *out = in->_m_ops[0];
+        int       op  = in->m_opcode;
+
+        if (op == VINSTR_JUMP) {
+            ir_sccp_reach(state, self, in->m_bops[0]);
+            continue;
+        }
+        if (op == VINSTR_COND) {
+            ir_sccp_value cond = ir_sccp_get(state, out);
+            if (cond.state == ir_sccp_value::CONSTANT && out->m_vtype == TYPE_FLOAT)
+                ir_sccp_reach(state, self, in->m_bops[ir_sccp_true(cond) ? 0 : 1]);
+            else if (cond.state != ir_sccp_value::UNDEFINED || settle) {
+                ir_sccp_reach(state, self, in->m_bops[0]);
+                ir_sccp_reach(state, self, in->m_bops[1]);
+            }
+            continue;
+        }
+
+        /* indexed stores read their first operand */
+        if (!out || !state.values.count(out) || op == INSTR_STOREA_F || op == INSTR_STOREA_V)
+            continue;
+
+        if (op == VINSTR_PHI) {
+            for (auto &pe : in->m_phi) {
+                if (state.edges.count(std::make_pair(pe.from, self)))
+                    ir_sccp_set(state, out, ir_sccp_get(state, pe.value));
+            }
+        }
+        else if (op >= INSTR_STORE_F && op <= INSTR_STORE_FNC) {
+            ir_sccp_set(state, out, ir_sccp_get(state, in->_m_ops[1]));
+        }
+        else {
+            ir_sccp_value a = ir_sccp_get(state, in->_m_ops[1]);
+            ir_sccp_value b = in->_m_ops[2] ? ir_sccp_get(state, in->_m_ops[2]) : a;
+            ir_sccp_value r;
+            if (a.state == ir_sccp_value::VARYING || b.state == ir_sccp_value::VARYING)
+                r = ir_sccp_varying();
+            else if (a.state == ir_sccp_value::UNDEFINED || b.state == ir_sccp_value::UNDEFINED)
+                continue;
+            else if (ir_sccp_fold(op, a.v, b.v, r.v))
+                r.state = ir_sccp_value::CONSTANT;
+            else
+                r = ir_sccp_varying();
+            ir_sccp_set(state, out, r);
+        }
+    }
+
+    /* blocks ending in something else, like a noreturn call */
+    if (self->m_instr.empty() ||
+        (self->m_instr.back()->m_opcode != VINSTR_JUMP && self->m_instr.back()->m_opcode != VINSTR_COND))
+    {
+        for (auto &e : self->m_exits)
+            ir_sccp_reach(state, self, e);
+    }
+}
+
+/* whether the single write to v comes before all of its reads */
+static bool ir_value_write_dominates(ir_value *v, std::vector<size_t> &position, std::vector<size_t> &idom)
+{
+    ir_instr *w = v->m_writes[0];
+    size_t    at = position[w->m_owner->m_eid];
+
+    if (idom[at] == (size_t)-1)
+        return false;
+    for (auto &r : v->m_reads) {
+        size_t p = position[r->m_owner->m_eid];
+        if (idom[p] == (size_t)-1)
+            return false;
+        if (p == at) {
+            auto &instr = w->m_owner->m_instr;
+            if (std::find(instr.begin(), instr.end(), w) > std::find(instr.begin(), instr.end(), r))
+                return false;
+            continue;
+        }
+        while (p > at)
+            p = idom[p];
+        if (p != at)
+            return false;
+    }
+    return true;
+}
+
+/* the literals are added to the builder's globals once every function is finalized */
+static ir_value *ir_sccp_literal(ir_function *self, ir_value *v, const ir_sccp_value &value)
+{
+    for (auto &lp : self->m_literals) {
+        ir_value *it = lp.get();
+        if (it->m_vtype != v->m_vtype)
+            continue;
+        if (v->m_vtype == TYPE_FLOAT && !memcmp(&it->m_constval.vfloat, value.v, sizeof(qcfloat_t)))
+            return it;
+        if (v->m_vtype == TYPE_VECTOR && !memcmp(&it->m_constval.vvec, value.v, sizeof(vec3_t)))
+            return it;
+    }
+
+    ir_value *lit = ir_value_literal(v->m_vtype);
+    if (v->m_vtype == TYPE_FLOAT)
+        lit->m_constval.vfloat = value.v[0];
+    else
+        lit->m_constval.vvec = vec3_t{ value.v[0], value.v[1], value.v[2] };
+    self->m_literals.emplace_back(lit);
+    return lit;
+}
+
+/* removes the edge from -> self, along with what its PHIs take along it */
+static void ir_block_forget_entry(ir_block *self, ir_block *from)
+{
+    size_t idx;
+    if (vec_ir_block_find(self->m_entries, from, &idx))
+        self->m_entries.erase(self->m_entries.begin() + idx);
+    for (auto &in : self->m_instr) {
+        for (size_t i = 0; i < in->m_phi.size(); ) {
+            ir_value *v = in->m_phi[i].value;
+            if (in->m_phi[i].from != from) {
+                ++i;
+                continue;
+            }
+            (void)!ir_value_remove_use(v->m_reads, v, in);
+            in->m_phi.erase(in->m_phi.begin() + i);
+        }
+    }
+}
+
+/* rewrites a COND into a JUMP to one of its targets */
+static void ir_block_fold_cond(ir_block *self, bool ontrue)
+{
+    ir_instr *cond  = self->m_instr.back();
+    ir_block *to    = cond->m_bops[ontrue ? 0 : 1];
+    ir_block *other = cond->m_bops[ontrue ? 1 : 0];
+    ir_instr *jump  = new ir_instr(cond->m_context, self, VINSTR_JUMP);
+    size_t    idx;
+
+    jump->m_bops[0] = to;
+    self->m_instr.back() = jump;
+    delete cond;
+
+    if (other == to)
+        return;
+    if (vec_ir_block_find(self->m_exits, other, &idx))
+        self->m_exits.erase(self->m_exits.begin() + idx);
+    ir_block_forget_entry(other, self);
+}
+
+static bool ir_value_is_read(ir_value *v)
+{
+    v = ir_value_root(v);
+    if (!v->m_reads.empty())
+        return true;
+    for (size_t m = 0; m < 3; ++m) {
+        if (v->m_members[m] && !v->m_members[m]->m_reads.empty())
+            return true;
+    }
+    return false;
+}
+
+/* returns whether the CFG changed, which may leave more to propagate */
+static bool ir_function_sccp_round(ir_function *self)
+{
+    std::vector<ir_block*> order;
+    std::vector<size_t>    position, idom;
+    std::vector<ir_value*> tracked;
+    ir_sccp_state          state;
+    bool                   settle = false;
+    bool                   changed = false;
+
+    ir_function_dominators(self, order, position, idom);
+
+    auto track = [&](ir_value *v) {
+        if (v->m_vtype != TYPE_FLOAT && v->m_vtype != TYPE_VECTOR)
+            return;
+        if (ir_value_write_count(v) != 1 || v->m_writes.size() != 1)
+            return;
+        if (v->m_store == store_local) {
+            int op = v->m_writes[0]->m_opcode;
+            if (op < INSTR_STORE_F || op > INSTR_STORE_FNC || !ir_value_write_dominates(v, position, idom))
+                return;
+        }
+        else if (v->m_store != store_value)
+            return;
+        state.values[v] = ir_sccp_varying();
+        state.values[v].state = ir_sccp_value::UNDEFINED;
+        tracked.push_back(v);
+    };
+    for (auto &lp : self->m_locals)
+        track(lp.get());
+    for (auto &vp : self->m_values)
+        track(vp.get());
+
+    /*
+     * Conditions still undefined once nothing changes anymore read
+     * values never computed on the way there, they may go either way.
+     */
+    state.reached.insert(order[0]);
+    do {
+        state.changed = false;
+        for (auto &b : order) {
+            if (state.reached.count(b))
+                ir_block_sccp(b, state, settle);
+        }
+        if (!state.changed && !settle)
+            settle = state.changed = true;
+    } while (state.changed);
+
+    /* in the function's order, so the literals are made in the same one */
+    for (auto &v : tracked) {
+        const ir_sccp_value &value = state.values[v];
+        ir_instr            *w     = v->m_writes[0];
+        if (value.state != ir_sccp_value::CONSTANT || !ir_value_is_read(v))
+            continue;
+        if (!state.reached.count(w->m_owner))
+            continue;
+        ++opts_optimizationcount[OPTIM_SCCP];
+        /* unread immediates are not generated, so members get their own */
+        for (size_t m = 0; m < 3; ++m) {
+            ir_sccp_value member = value;
+            if (!v->m_members[m] || v->m_members[m]->m_reads.empty())
+                continue;
+            member.v[0] = value.v[m];
+            ir_value_replace_reads(v->m_members[m],
+                                   ir_sccp_literal(self, v->m_members[m], member));
+        }
+        if (!v->m_reads.empty())
+            ir_value_replace_reads(v, ir_sccp_literal(self, v, value));
+    }
+
+    for (auto &b : order) {
+        ir_instr      *cond;
+        ir_sccp_value  value;
+        if (!state.reached.count(b) || b->m_instr.empty())
+            continue;
+        cond = b->m_instr.back();
+        if (cond->m_opcode != VINSTR_COND || cond->_m_ops[0]->m_vtype != TYPE_FLOAT)
+            continue;
+        value = ir_sccp_get(state, cond->_m_ops[0]);
+        if (value.state != ir_sccp_value::CONSTANT)
+            continue;
+        ++opts_optimizationcount[OPTIM_SCCP];
+        ir_block_fold_cond(b, ir_sccp_true(value));
+        changed = true;
+    }
+
+    for (auto &bp : self->m_blocks) {
+        ir_block *b = bp.get();
+        if (state.reached.count(b))
+            continue;
+        ++opts_optimizationcount[OPTIM_SCCP];
+        changed = true;
+        for (auto &e : b->m_exits) {
+            if (state.reached.count(e))
+                ir_block_forget_entry(e, b);
+        }
+        for (auto &in : b->m_instr)
+            ir_instr_remove(in);
+        b->m_instr.clear();
+    }
+    self->m_blocks.erase(std::remove_if(self->m_blocks.begin(), self->m_blocks.end(),
+                                        [&](const std::unique_ptr<ir_block> &b) {
+                                            return !state.reached.count(b.get());
+                                        }),
+                         self->m_blocks.end());
+    return changed;
+}
+
+static bool ir_function_pass_sccp(ir_function *self)
+{
+    if (self->m_blocks.empty())
+        return true;
+    while (ir_function_sccp_round(self))
+        ;
+    return true;
+}
+
+/*
+ * Dead code elimination: operations whose result nobody reads and
+ * stores into locals which are never read, except elements of local
+ * arrays.
+ */
+static bool ir_function_pass_dce(ir_function *self)
+{
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &bp : self->m_blocks) {
+            ir_block *block = bp.get();
+            for (size_t i = block->m_instr.size(); i-- > 0; ) {
+                ir_instr *in  = block->m_instr[i];
+                ir_value *out = in->_m_ops[0];
+                int       op  = in->m_opcode;
+
+                if (!out || ir_value_is_read(out))
+                    continue;
+                if (op == VINSTR_PHI || (instr_is_operation(op) && (op < INSTR_CALL0 || op > INSTR_CALL8))) {
+                    if (out->m_store != store_value)
+                        continue;
+                }
+                else if (op >= INSTR_STORE_F && op <= INSTR_STORE_FNC) {
+                    /* local array elements are read by their accessors */
+                    ir_value *root = ir_value_root(out);
+                    if (root->m_store != store_local || root->m_unique_life || out->m_unique_life)
+                        continue;
+                }
+                else
+                    continue;
+
+                ++opts_optimizationcount[OPTIM_DCE];
+                block->m_instr.erase(block->m_instr.begin() + i);
+                ir_instr_remove(in);
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+/* whether an instruction may change any global */
+static bool ir_instr_clobbers_globals(int op)
+{
+    return (op >= INSTR_CALL0 && op <= INSTR_CALL8) || op == VINSTR_NRCALL ||
+           op == INSTR_STATE || op == INSTR_STOREA_F || op == INSTR_STOREA_V;
+}
+
+/*
+ * Copy propagation: after a STORE of one value into a local or
+ * temporary, the target's reads read the source instead, as long as
+ * neither of them was written on any path in between.  Globals can be
+ * sources until the next call, STATE or indexed store.  Elements of local
+ * arrays are left alone, their accessors use them behind the function's
+ * back.  Every link of a chain of copies takes another round.  Stores
+ * left without reads are up to dead store elimination.
+ */
+struct ir_copy {
+    ir_value *dst;
+    ir_value *src;
+};
+
+struct ir_copy_state {
+    std::vector<ir_copy>                               copies;
+    std::unordered_map<ir_instr*, size_t>              index;
+    /* the copies the root of a value takes part in */
+    std::unordered_map<ir_value*, std::vector<size_t>> uses;
+    /* the copies from globals which may change */
+    std::vector<size_t>                                globals;
+    /* the copies available at the end of each block */
+    std::vector<ir_bitset>                             out;
+    std::vector<bool>                                  visited;
+};
+
+static bool ir_copy_candidate(ir_instr *in)
+{
+    ir_value *dst, *src;
+
+    if (in->m_opcode < INSTR_STORE_F || in->m_opcode > INSTR_STORE_FNC)
+        return false;
+    dst = in->_m_ops[0];
+    src = in->_m_ops[1];
+    if (dst == src || dst->m_memberof || dst->m_unique_life)
+        return false;
+    if (dst->m_store != store_value && dst->m_store != store_local && dst->m_store != store_param)
+        return false;
+    if (dst->m_vtype != src->m_vtype ||
+        (dst->m_vtype == TYPE_FIELD && dst->m_fieldtype != src->m_fieldtype))
+        return false;
+
+    src = ir_value_root(src);
+    switch (src->m_store) {
+        case store_value:
+        case store_local:
+        case store_param:
+            return !src->m_unique_life;
+        case store_global:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* what an instruction changes about the available copies */
+static void ir_copy_step(ir_copy_state &state, ir_instr *in, ir_bitset &avail)
+{
+    ir_value *out = ir_instr_written(in);
+
+    if (ir_instr_clobbers_globals(in->m_opcode)) {
+        for (auto &c : state.globals)
+            avail.reset(c);
+    }
+    if (out) {
+        auto it = state.uses.find(ir_value_root(out));
+        if (it != state.uses.end()) {
+            for (auto &c : it->second)
+                avail.reset(c);
+        }
+    }
+    auto it = state.index.find(in);
+    if (it != state.index.end())
+        avail.set(it->second);
+}
+
+/* the copies available on every path into a block visited so far */
+static void ir_copy_in(ir_copy_state &state, ir_block *block, ir_bitset &avail)
+{
+    bool first = true;
+
+    avail.resize(state.copies.size());
+    if (block == block->m_owner->m_blocks[0].get())
+        return;
+    for (auto &e : block->m_entries) {
+        if (!state.visited[e->m_eid])
+            continue;
+        if (first)
+            avail = state.out[e->m_eid];
+        else
+            avail.intersect(state.out[e->m_eid]);
+        first = false;
+    }
+}
+
+static bool ir_block_copyprop(ir_copy_state &state, ir_block *self)
+{
+    ir_bitset avail;
+    bool      changed = false;
+
+    ir_copy_in(state, self, avail);
+    for (auto &in : self->m_instr) {
+        ir_value *out  = ir_instr_written(in);
+        size_t    read = ir_instr_read_mask(in);
+
+        auto source = [&](ir_value *v) -> ir_value* {
+            auto it = state.uses.find(v);
+            if (v->m_memberof || it == state.uses.end())
+                return nullptr;
+            for (auto &c : it->second) {
+                ir_value *src = state.copies[c].src;
+                if (!avail.test(c) || state.copies[c].dst != v)
+                    continue;
+                /* other instructions may write parts of their output first */
+                if (out && ir_value_root(out) == ir_value_root(src) &&
+                    (in->m_opcode < INSTR_STORE_F || in->m_opcode > INSTR_STORE_FNC))
+                    return nullptr;
+                return src;
+            }
+            return nullptr;
+        };
+
+        /* what PHIs read comes from the end of another block */
+        if (in->m_opcode != VINSTR_PHI) {
+            for (size_t o = 0; o < 3; ++o) {
+                ir_value *src;
+                if (!(read & (1 << o)) || !in->_m_ops[o] || !(src = source(in->_m_ops[o])))
+                    continue;
+                (void)!ir_instr_op(in, o, src, false);
+                ++opts_optimizationcount[OPTIM_COPY_PROP];
+                changed = true;
+            }
+            for (auto &p : in->m_params) {
+                ir_value *src = source(p);
+                if (!src)
+                    continue;
+                (void)!ir_value_remove_use(p->m_reads, p, in);
+                p = src;
+                ir_value_add_use(src->m_reads, src, in);
+                ++opts_optimizationcount[OPTIM_COPY_PROP];
+                changed = true;
+            }
+        }
+        ir_copy_step(state, in, avail);
+    }
+    return changed;
+}
+
+static bool ir_function_pass_copyprop(ir_function *self)
+{
+    bool changed = true;
+
+    while (changed) {
+        ir_copy_state state;
+        changed = false;
+
+        for (size_t i = 0; i < self->m_blocks.size(); ++i)
+            self->m_blocks[i]->m_eid = i;
+        for (auto &bp : self->m_blocks) {
+            for (auto &in : bp->m_instr) {
+                ir_value *dst, *src;
+                size_t    c = state.copies.size();
+                if (!ir_copy_candidate(in))
+                    continue;
+                dst = in->_m_ops[0];
+                src = in->_m_ops[1];
+                state.copies.push_back({ dst, src });
+                state.index[in] = c;
+                state.uses[dst].push_back(c);
+                if (ir_value_root(src) != dst)
+                    state.uses[ir_value_root(src)].push_back(c);
+                if (ir_value_root(src)->m_store == store_global &&
+                    !(src->m_hasvalue && src->m_cvq == CV_CONST))
+                    state.globals.push_back(c);
+            }
+        }
+        if (state.copies.empty())
+            break;
+
+        state.out.resize(self->m_blocks.size());
+        state.visited.assign(self->m_blocks.size(), false);
+        ir_function_solve_dataflow(self, false, [&](ir_block *block) {
+            ir_bitset avail;
+            ir_copy_in(state, block, avail);
+            for (auto &in : block->m_instr)
+                ir_copy_step(state, in, avail);
+            if (state.visited[block->m_eid] && avail.m_words == state.out[block->m_eid].m_words)
+                return false;
+            state.visited[block->m_eid] = true;
+            state.out[block->m_eid] = avail;
+            return true;
+        });
+
+        for (auto &bp : self->m_blocks)
+            changed = ir_block_copyprop(state, bp.get()) || changed;
+    }
+    return true;
+}
+
+/*
+ * Dead store elimination: stores into locals, and operations writing
+ * them, are removed when no path from there reads the local before it
+ * is written again.  A backward liveness analysis over the blocks finds
+ * them, where writing part of a vector keeps the rest of it alive.  Like
+ * copy propagation it leaves the elements of local arrays alone.  Writes
+ * to temporaries nothing reads go as well.
+ */
+struct ir_dse_state {
+    std::unordered_map<ir_value*, size_t> index;
+    /* the tracked locals living at the start of each block */
+    std::vector<ir_bitset>                livein;
+};
+
+static bool ir_dse_removable(int op)
+{
+    return (op >= INSTR_STORE_F && op <= INSTR_STORE_FNC) ||
+           (instr_is_operation(op) && (op < INSTR_CALL0 || op > INSTR_CALL8));
+}
+
+/* moves the living locals from after an instruction to before it */
+static void ir_dse_step(ir_dse_state &state, ir_instr *in, ir_bitset &live)
+{
+    ir_value *out  = ir_instr_written(in);
+    size_t    read = ir_instr_read_mask(in);
+
+    auto use = [&](ir_value *v) {
+        auto it = state.index.find(ir_value_root(v));
+        if (it != state.index.end())
+            live.set(it->second);
+    };
+
+    if (out && !out->m_memberof) {
+        auto it = state.index.find(out);
+        if (it != state.index.end())
+            live.reset(it->second);
+    }
+    for (size_t o = 0; o < 3; ++o) {
+        if ((read & (1 << o)) && in->_m_ops[o])
+            use(in->_m_ops[o]);
+    }
+    for (auto &p : in->m_params)
+        use(p);
+    for (auto &pe : in->m_phi)
+        use(pe.value);
+}
+
+static void ir_dse_out(ir_dse_state &state, ir_block *block, ir_bitset &live)
+{
+    live.resize(state.index.size());
+    for (auto &e : block->m_exits)
+        live.merge(state.livein[e->m_eid]);
+}
+
+static bool ir_block_dse(ir_dse_state &state, ir_block *self)
+{
+    ir_bitset live;
+    bool      changed = false;
+
+    ir_dse_out(state, self, live);
+    for (size_t i = self->m_instr.size(); i-- > 0; ) {
+        ir_instr *in  = self->m_instr[i];
+        ir_value *out = ir_instr_written(in);
+
+        if (out && ir_dse_removable(in->m_opcode)) {
+            auto it   = state.index.find(ir_value_root(out));
+            bool dead = it != state.index.end()
+                      ? !live.test(it->second)
+                      : out->m_store == store_value && !ir_value_is_read(out);
+            if (dead) {
+                ++opts_optimizationcount[OPTIM_DSE];
+                self->m_instr.erase(self->m_instr.begin() + i);
+                ir_instr_remove(in);
+                changed = true;
+                continue;
+            }
+        }
+        ir_dse_step(state, in, live);
+    }
+    return changed;
+}
+
+static bool ir_function_pass_dse(ir_function *self)
+{
+    bool changed = true;
+
+    while (changed) {
+        ir_dse_state state;
+        changed = false;
+
+        for (auto &lp : self->m_locals) {
+            ir_value *v = lp.get();
+            if (!v->m_unique_life)
+                state.index.emplace(v, state.index.size());
+        }
+        for (size_t i = 0; i < self->m_blocks.size(); ++i)
+            self->m_blocks[i]->m_eid = i;
+        state.livein.resize(self->m_blocks.size());
+        for (auto &it : state.livein)
+            it.resize(state.index.size());
+
+        ir_function_solve_dataflow(self, true, [&](ir_block *block) {
+            ir_bitset live;
+            ir_dse_out(state, block, live);
+            for (size_t i = block->m_instr.size(); i-- > 0; )
+                ir_dse_step(state, block->m_instr[i], live);
+            if (live.m_words == state.livein[block->m_eid].m_words)
+                return false;
+            state.livein[block->m_eid] = live;
+            return true;
+        });
+
+        for (auto &bp : self->m_blocks)
+            changed = ir_block_dse(state, bp.get()) || changed;
+    }
+    return true;
+}
+
+static bool ir_function_pass_peephole(ir_function *self)
+{
+    for (auto& bp : self->m_blocks) {
+        ir_block *block = bp.get();
+        for (size_t i = 0; i < block->m_instr.size(); ++i) {
+            ir_instr *inst;
+            inst = block->m_instr[i];
+
+            if (i >= 1 &&
+                (inst->m_opcode >= INSTR_STORE_F &&
+                 inst->m_opcode <= INSTR_STORE_FNC))
+            {
+                ir_instr *store;
+                ir_instr *oper;
+                ir_value *value;
+
+                store = inst;
+
+                oper  = block->m_instr[i-1];
+                if (!instr_is_operation(oper->m_opcode) &&
+                    oper->m_opcode != INSTR_LOADA_F && oper->m_opcode != INSTR_LOADA_V)
+                {
+                    continue;
+                }
+
+                /* Don't change semantics of MUL_VF in engines where these may not alias. */
+                if (OPTS_FLAG(LEGACY_VECTOR_MATHS)) {
+                    if (oper->m_opcode == INSTR_MUL_VF && oper->_m_ops[2]->m_memberof == oper->_m_ops[1])
+                        continue;
+                    if (oper->m_opcode == INSTR_MUL_FV && oper->_m_ops[1]->m_memberof == oper->_m_ops[2])
+                        continue;
+                }
+
+                /* The emulated instructions write parts of their output before
+                 * reading all of their sources, so they must not overlap. */
+                if (oper->m_opcode >= VINSTR_BITAND_V && oper->m_opcode <= VINSTR_CROSS &&
+                    OPTS_OPTION_U32(OPTION_TARGET) != TARGET_GMQCC_EXT &&
+                    (ir_value_root(store->_m_ops[0]) == ir_value_root(oper->_m_ops[1]) ||
+                     ir_value_root(store->_m_ops[0]) == ir_value_root(oper->_m_ops[2])))
+                {
+                    continue;
+                }
+
+                value = oper->_m_ops[0];
+
+                /* only do it for SSA values */
+                if (value->m_store != store_value)
+                    continue;
+
+                /* don't optimize out the temp if it's used later again */
+                if (value->m_reads.size() != 1)
+                    continue;
+
+                /* The very next store must use this value */
+                if (value->m_reads[0] != store)
+                    continue;
+
+                /* And of course the store must _read_ from it, so it's in
+                 * OP 1 */
+                if (store->_m_ops[1] != value)
+                    continue;
+
+                ++opts_optimizationcount[OPTIM_PEEPHOLE];
+                (void)!ir_instr_op(oper, 0, store->_m_ops[0], true);
+
+                block->m_instr.erase(block->m_instr.begin() + i);
+                delete store;
+            }
+            else if (inst->m_opcode == VINSTR_COND)
+            {
+                /* COND on a value resulting from a NOT could
+                 * remove the NOT and swap its operands
+                 */
+                while (true) {
+                    ir_block *tmp;
+                    size_t    inotid;
+                    ir_instr *inot;
+                    ir_value *value;
+                    value = inst->_m_ops[0];
+
+                    if (value->m_store != store_value || value->m_reads.size() != 1 || value->m_reads[0] != inst)
+                        break;
+
+                    inot = value->m_writes[0];
+                    if (inot->_m_ops[0] != value ||
+                        inot->m_opcode < INSTR_NOT_F ||
+                        inot->m_opcode > INSTR_NOT_FNC ||
+                        inot->m_opcode == INSTR_NOT_V || /* can't do these */
+                        inot->m_opcode == INSTR_NOT_S)
+                    {
+                        break;
+                    }
+
+                    /* count */
+                    ++opts_optimizationcount[OPTIM_PEEPHOLE];
+                    /* change operand */
+                    (void)!ir_instr_op(inst, 0, inot->_m_ops[1], false);
+                    /* remove NOT */
+                    tmp = inot->m_owner;
+                    for (inotid = 0; inotid < tmp->m_instr.size(); ++inotid) {
+                        if (tmp->m_instr[inotid] == inot)
+                            break;
+                    }
+                    if (inotid >= tmp->m_instr.size()) {
+                        compile_error(inst->m_context, "sanity-check failed: failed to find instruction to optimize out");
+                        return false;
+                    }
+                    tmp->m_instr.erase(tmp->m_instr.begin() + inotid);
+                    delete inot;
+                    /* swap ontrue/onfalse */
+                    tmp = inst->m_bops[0];
+                    inst->m_bops[0] = inst->m_bops[1];
+                    inst->m_bops[1] = tmp;
+                }
+                continue;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool ir_function_pass_tailrecursion(ir_function *self)
+{
+    size_t p;
+
+    for (auto& bp : self->m_blocks) {
+        ir_block *block = bp.get();
+
+        ir_value *funcval;
+        ir_instr *ret, *call, *store = nullptr;
+
+        if (!block->m_final || block->m_instr.size() < 2)
+            continue;
+
+        ret = block->m_instr.back();
+        if (ret->m_opcode != INSTR_DONE && ret->m_opcode != INSTR_RETURN)
+            continue;
+
+        call = block->m_instr[block->m_instr.size()-2];
+        if (call->m_opcode >= INSTR_STORE_F && call->m_opcode <= INSTR_STORE_FNC) {
+            /* account for the unoptimized
+             * CALL
+             * STORE %return, %tmp
+             * RETURN %tmp
+             * version
+             */
+            if (block->m_instr.size() < 3)
+                continue;
+
+            store = call;
+            call = block->m_instr[block->m_instr.size()-3];
+        }
+
+        if (call->m_opcode < INSTR_CALL0 || call->m_opcode > INSTR_CALL8)
+            continue;
+
+        if (store) {
+            /* optimize out the STORE */
+            if (ret->_m_ops[0]   &&
+                ret->_m_ops[0]   == store->_m_ops[0] &&
+                store->_m_ops[1] == call->_m_ops[0])
+            {
+                ++opts_optimizationcount[OPTIM_PEEPHOLE];
+                call->_m_ops[0] = store->_m_ops[0];
+                block->m_instr.erase(block->m_instr.end()-2);
+                delete store;
+            }
+            else
+                continue;
+        }
+
+        if (!call->_m_ops[0])
+            continue;
+
+        funcval = call->_m_ops[1];
+        if (!funcval)
+            continue;
+        if (funcval->m_vtype != TYPE_FUNCTION || funcval->m_constval.vfunc != self)
+            continue;
+
+        /* now we have a CALL and a RET, check if it's a tailcall */
+        if (ret->_m_ops[0] && call->_m_ops[0] != ret->_m_ops[0])
+            continue;
+
+        ++opts_optimizationcount[OPTIM_TAIL_RECURSION];
+        block->m_instr.erase(block->m_instr.end()-2, block->m_instr.end());
+
+        block->m_final = false; /* open it back up */
+
+        /* emite parameter-stores */
+        for (p = 0; p < call->m_params.size(); ++p) {
+            /* assert(call->params_count <= self->locals_count); */
+            if (!ir_block_create_store(block, call->m_context, self->m_locals[p].get(), call->m_params[p])) {
+                irerror(call->m_context, "failed to create tailcall store instruction for parameter %i", (int)p);
+                return false;
+            }
+        }
+        if (!ir_block_create_jump(block, call->m_context, self->m_blocks[0].get())) {
+            irerror(call->m_context, "failed to create tailcall jump");
+            return false;
+        }
+
+        delete call;
+        delete ret;
+    }
+
+    return true;
+}
+
+/*
+ * Lay out every branch the profile knows about so its more frequent
+ * successor falls through.  The counts are keyed by the position of the
+ * condition, so this has to see the same conditions as the profiled
+ * build did: it runs after the passes which rewrite them.
+ */
+static void ir_function_pass_profile(ir_function *self)
+{
+    for (auto& bp : self->m_blocks) {
+        ir_block *block = bp.get();
+        ir_instr *cond;
+        uint64_t  ontrue, onfalse;
+
+        if (block->m_instr.empty())
+            continue;
+        cond = block->m_instr.back();
+        if (cond->m_opcode != VINSTR_COND)
+            continue;
+        if (!profile_branch(self->m_name.c_str(), cond->m_context.line, cond->m_context.column, &ontrue, &onfalse))
+            continue;
+        if (ontrue == onfalse)
+            continue;
+        cond->m_likely = ontrue > onfalse;
+    }
+}
+
+/*
+ * Inlining: replace calls to small functions by a copy of their body.
+ * The callee's locals and temporaries become temporaries of the caller,
+ * its parameters are stored into before jumping to the copied entry
+ * block and every RETURN stores into the value the call produced and
+ * jumps to the rest of the calling block.
+ */
+#define IR_INLINE_MAX_INSTR     12   /* callees at most this large are inlined */
+#define IR_INLINE_MAX_HOT_INSTR 64   /* with -fprofile-use, at call sites this hot */
+#define IR_INLINE_HOT_COUNT     1000
+#define IR_INLINE_MAX_GROWTH    4    /* a caller may grow to this times its size */
+
+static size_t ir_function_instr_count(ir_function *self)
+{
+    size_t count = 0;
+    for (auto& bp : self->m_blocks)
+        count += bp->m_instr.size();
+    return count;
+}
+
+static ir_function *ir_function_inline_callee(ir_function *self, ir_instr *call)
+{
+    ir_value    *funcval = call->_m_ops[1];
+    ir_function *callee;
+
+    if (call->m_opcode != INSTR_CALL0)
+        return nullptr;
+    if (funcval->m_vtype != TYPE_FUNCTION || !funcval->m_hasvalue)
+        return nullptr;
+    if (funcval->m_cvq != CV_CONST && funcval->m_writes.size())
+        return nullptr;
+
+    callee = funcval->m_constval.vfunc;
+    if (!callee || callee == self || callee->m_builtin || callee->m_finalized)
+        return nullptr;
+    if (callee->m_blocks.empty() || callee->m_max_varargs)
+        return nullptr;
+    if (callee->m_flags & IR_FLAG_HAS_ARRAYS)
+        return nullptr;
+    if (call->m_params.size() != callee->m_params.size())
+        return nullptr;
+
+    for (auto& bp : callee->m_blocks) {
+        for (auto &in : bp->m_instr) {
+            if (in->m_opcode == INSTR_RETURN && !in->_m_ops[0] &&
+                callee->m_outtype != TYPE_VOID && call->_m_ops[0]->m_reads.size())
+                return nullptr;
+            for (size_t o = 0; o < 3; ++o) {
+                ir_value *v = in->_m_ops[o];
+                if (!v)
+                    continue;
+                /* recursive or reading the count of variadic arguments */
+                if (v == callee->m_value || v == self->m_owner->m_reserved_va_count)
+                    return nullptr;
+            }
+        }
+    }
+    for (auto& vp : callee->m_values)
+        if (vp->m_hasvalue)
+            return nullptr;
+
+    return callee;
+}
+
+static ir_value *ir_inline_map(std::unordered_map<ir_value*, ir_value*> &map, ir_value *v)
+{
+    if (!v)
+        return nullptr;
+    auto it = map.find(v);
+    if (it != map.end())
+        return it->second;
+    if (v->m_memberof) {
+        it = map.find(v->m_memberof);
+        if (it != map.end())
+            return it->second->vectorMember(v->m_code.addroffset);
+    }
+    return v;
+}
+
+static ir_value *ir_inline_clone_value(ir_function *self, ir_value *v)
+{
+    ir_value *c = new ir_value(self, std::string(v->m_name),
+                               v->m_store == store_param ? store_local : v->m_store,
+                               v->m_vtype);
+    c->m_context   = v->m_context;
+    c->m_fieldtype = v->m_fieldtype;
+    c->m_outtype   = v->m_outtype;
+    c->m_cvq       = v->m_cvq;
+    c->m_flags     = v->m_flags | IR_FLAG_INLINED;
+    return c;
+}
+
+/* the instructions of the block from at on move into a new block */
+static ir_block *ir_block_split_after(ir_block *self, size_t at)
+{
+    ir_function *func = self->m_owner;
+    ir_block    *cont = new ir_block(func, self->m_label + "_inl");
+
+    cont->m_context = self->m_context;
+    func->m_blocks.emplace_back(cont);
+
+    for (size_t i = at; i < self->m_instr.size(); ++i) {
+        self->m_instr[i]->m_owner = cont;
+        cont->m_instr.push_back(self->m_instr[i]);
+    }
+    self->m_instr.resize(at);
+
+    cont->m_exits      = move(self->m_exits);
+    cont->m_final      = self->m_final;
+    cont->m_is_return  = self->m_is_return;
+    self->m_exits.clear();
+    self->m_final      = false;
+    self->m_is_return  = false;
+
+    for (auto &e : cont->m_exits) {
+        for (auto &entry : e->m_entries) {
+            if (entry == self)
+                entry = cont;
+        }
+        for (auto &in : e->m_instr) {
+            for (auto &pe : in->m_phi) {
+                if (pe.from == self)
+                    pe.from = cont;
+            }
+        }
+    }
+    return cont;
+}
+
+static bool ir_function_inline_call(ir_function *self, ir_block *block, size_t at, ir_function *callee,
+                                    ir_block **rest)
+{
+    std::unordered_map<ir_value*, ir_value*> values;
+    std::unordered_map<ir_block*, ir_block*> blocks;
+    ir_instr *call = block->m_instr[at];
+    ir_value *out  = call->_m_ops[0];
+    ir_block *cont;
+
+    if (callee->m_outtype == TYPE_VOID || out->m_reads.empty())
+        out = nullptr;
+
+    for (auto& vp : callee->m_locals)
+        values[vp.get()] = ir_inline_clone_value(self, vp.get());
+    for (auto& vp : callee->m_values)
+        values[vp.get()] = ir_inline_clone_value(self, vp.get());
+
+    for (auto& bp : callee->m_blocks) {
+        ir_block *b = new ir_block(self, callee->m_name + "_" + bp->m_label);
+        b->m_context = bp->m_context;
+        self->m_blocks.emplace_back(b);
+        blocks[bp.get()] = b;
+    }
+
+    cont = *rest = ir_block_split_after(block, at + 1);
+    block->m_instr.pop_back();
+
+    if (out) {
+        /* written once per inlined return now */
+        out->m_store = store_local;
+        out->m_flags |= IR_FLAG_INLINED;
+        for (size_t m = 0; m < 3; ++m) {
+            if (out->m_members[m]) {
+                out->m_members[m]->m_store = store_local;
+                out->m_members[m]->m_flags |= IR_FLAG_INLINED;
+            }
+        }
+    }
+
+    for (auto& bp : callee->m_blocks) {
+        ir_block *b = blocks[bp.get()];
+        for (auto &e : bp->m_entries)
+            b->m_entries.push_back(blocks[e]);
+        for (auto &e : bp->m_exits)
+            b->m_exits.push_back(blocks[e]);
+
+        for (auto &in : bp->m_instr) {
+            if (in->m_opcode == INSTR_RETURN || in->m_opcode == INSTR_DONE) {
+                if (out && !ir_block_create_store(b, in->m_context, out, ir_inline_map(values, in->_m_ops[0])))
+                    return false;
+                if (!ir_block_create_jump(b, in->m_context, cont))
+                    return false;
+                continue;
+            }
+
+            ir_instr *c = new ir_instr(in->m_context, b, in->m_opcode);
+            size_t read, write;
+            ir_op_read_write(in->m_opcode, &read, &write);
+            for (size_t o = 0; o < 3; ++o) {
+                bool writing = (write & (1 << o)) && in->m_opcode != INSTR_STATE;
+                if (!ir_instr_op(c, o, ir_inline_map(values, in->_m_ops[o]), writing)) {
+                    delete c;
+                    return false;
+                }
+            }
+            for (auto &pe : in->m_phi) {
+                ir_phi_entry_t entry = { ir_inline_map(values, pe.value), blocks[pe.from] };
+                entry.value->m_reads.push_back(c);
+                c->m_phi.push_back(entry);
+            }
+            for (auto &p : in->m_params) {
+                ir_value *v = ir_inline_map(values, p);
+                v->m_reads.push_back(c);
+                c->m_params.push_back(v);
+            }
+            c->m_bops[0] = in->m_bops[0] ? blocks[in->m_bops[0]] : nullptr;
+            c->m_bops[1] = in->m_bops[1] ? blocks[in->m_bops[1]] : nullptr;
+            c->m_likely  = in->m_likely;
+            b->m_instr.push_back(c);
+        }
+        b->m_final = b->m_final || bp->m_final;
+    }
+
+    for (size_t p = 0; p < call->m_params.size(); ++p) {
+        if (!ir_block_create_store(block, call->m_context, values[callee->m_locals[p].get()], call->m_params[p]))
+            return false;
+    }
+    if (!ir_block_create_jump(block, call->m_context, blocks[callee->m_blocks[0].get()]))
+        return false;
+
+    ir_instr_remove(call);
+    ++opts_optimizationcount[OPTIM_INLINE];
+    return true;
+}
+
+bool ir_function_inline(ir_function *self)
+{
+    std::vector<ir_block*> work;
+    size_t size, limit;
+
+    if (self->m_builtin)
+        return true;
+
+    size  = ir_function_instr_count(self);
+    limit = size * IR_INLINE_MAX_GROWTH + IR_INLINE_MAX_INSTR;
+
+    /* only the calls of the function itself, not the ones of inlined bodies */
+    for (auto& bp : self->m_blocks)
+        work.push_back(bp.get());
+
+    while (!work.empty()) {
+        ir_block *block = work.back();
+        work.pop_back();
+
+        for (size_t i = 0; i < block->m_instr.size(); ++i) {
+            ir_instr    *call = block->m_instr[i];
+            ir_function *callee;
+            ir_block    *rest;
+            size_t       cost;
+
+            if (call->m_opcode < INSTR_CALL0 || call->m_opcode > INSTR_CALL8)
+                continue;
+            if (!(callee = ir_function_inline_callee(self, call)))
+                continue;
+
+            /* the line may run without making the call, so the callee has to be hot too */
+            cost = ir_function_instr_count(callee);
+            if (cost > IR_INLINE_MAX_INSTR &&
+                (cost > IR_INLINE_MAX_HOT_INSTR || !OPTS_OPTION_STR(OPTION_PROFILE_USE) ||
+                 profile_line(self->m_name.c_str(), call->m_context.line) < IR_INLINE_HOT_COUNT ||
+                 profile_calls(callee->m_name.c_str()) < IR_INLINE_HOT_COUNT))
+                continue;
+            if (size + cost > limit)
+                continue;
+
+            if (!ir_function_inline_call(self, block, i, callee, &rest)) {
+                irerror(call->m_context, "failed to inline `%s` into `%s`",
+                        callee->m_name.c_str(), self->m_name.c_str());
+                return false;
+            }
+            size += cost;
+            work.push_back(rest);
+            break;
+        }
+    }
+    return true;
+}
+
+/*
+ * Block layout, once PHIs are resolved.  Edges into blocks holding
+ * nothing but a jump go straight on to where it leads, and the jumps
+ * back to the top of a loop get a copy of its condition when that is
+ * computed in a few operations, so every iteration ends in a single
+ * conditional jump instead of an unconditional one to the test.  Blocks
+ * from which every path ends in a noreturn call are cold: branches
+ * keep them out of line, and the code generator places them after the
+ * rest of the function.
+ */
+#define IR_LAYOUT_MAX_COPY 4 /* operations of a loop condition to copy */
+
+/* moves the edge from self into from over to to */
+static void ir_block_retarget(ir_block *self, ir_block *from, ir_block *to)
+{
+    size_t idx;
+    for (auto &e : self->m_exits) {
+        if (e == from) {
+            e = to;
+            break;
+        }
+    }
+    if (vec_ir_block_find(from->m_entries, self, &idx))
+        from->m_entries.erase(from->m_entries.begin() + idx);
+    to->m_entries.push_back(self);
+}
+
+static ir_block *ir_block_jump_target(ir_function *self, ir_block *block)
+{
+    for (size_t hops = 0; hops < self->m_blocks.size(); ++hops) {
+        if (block->m_instr.size() != 1 || block->m_instr[0]->m_opcode != VINSTR_JUMP)
+            break;
+        if (block->m_instr[0]->m_bops[0] == block)
+            break;
+        block = block->m_instr[0]->m_bops[0];
+    }
+    return block;
+}
+
+static bool ir_function_layout_thread(ir_function *self)
+{
+    bool changed = false;
+    for (auto& bp : self->m_blocks) {
+        ir_block *block = bp.get();
+        ir_instr *last;
+        if (block->m_instr.empty())
+            continue;
+        last = block->m_instr.back();
+        if (last->m_opcode != VINSTR_JUMP && last->m_opcode != VINSTR_COND)
+            continue;
+        for (size_t i = 0; i < (last->m_opcode == VINSTR_COND ? 2u : 1u); ++i) {
+            ir_block *from = last->m_bops[i];
+            ir_block *to   = ir_block_jump_target(self, from);
+            if (to == from || to == block)
+                continue;
+            ir_block_retarget(block, from, to);
+            last->m_bops[i] = to;
+            ++opts_optimizationcount[OPTIM_BLOCK_LAYOUT];
+            changed = true;
+        }
+        if (last->m_opcode == VINSTR_COND && last->m_bops[0] == last->m_bops[1]) {
+            ir_block_fold_cond(block, true);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* whether the condition ending block can be copied to the end of another */
+static bool ir_block_layout_copyable(ir_block *block)
+{
+    size_t count = block->m_instr.size();
+    if (count < 1 || count > IR_LAYOUT_MAX_COPY + 1 || block->m_instr.back()->m_opcode != VINSTR_COND)
+        return false;
+    for (size_t i = 0; i + 1 < count; ++i) {
+        ir_instr *in  = block->m_instr[i];
+        ir_value *out = in->_m_ops[0];
+        if (!instr_is_operation(in->m_opcode) || (in->m_opcode >= INSTR_CALL0 && in->m_opcode <= INSTR_CALL8))
+            return false;
+        if (!out || out->m_store != store_value || out->m_writes.size() != 1 ||
+            out->m_members[0] || out->m_members[1] || out->m_members[2])
+        {
+            return false;
+        }
+        for (auto &r : out->m_reads) {
+            if (r->m_owner != block)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* replaces the jump ending block by a copy of the condition computed in to */
+static bool ir_block_layout_copy(ir_block *block, ir_block *to)
+{
+    std::unordered_map<ir_value*, ir_value*> values;
+    ir_instr *jump = block->m_instr.back();
+    size_t    idx;
+
+    block->m_instr.pop_back();
+    delete jump;
+    if (vec_ir_block_find(block->m_exits, to, &idx))
+        block->m_exits.erase(block->m_exits.begin() + idx);
+    if (vec_ir_block_find(to->m_entries, block, &idx))
+        to->m_entries.erase(to->m_entries.begin() + idx);
+
+    for (auto &in : to->m_instr) {
+        ir_instr *c = new ir_instr(in->m_context, block, in->m_opcode);
+        for (size_t o = 0; o < 3; ++o) {
+            ir_value *v = ir_inline_map(values, in->_m_ops[o]);
+            bool writing = (o == 0 && in->m_opcode != VINSTR_COND);
+            if (writing) {
+                v = new ir_value(block->m_owner, std::string(v->m_name), store_value, v->m_vtype);
+                v->m_context   = in->_m_ops[0]->m_context;
+                v->m_fieldtype = in->_m_ops[0]->m_fieldtype;
+                v->m_outtype   = in->_m_ops[0]->m_outtype;
+                values[in->_m_ops[0]] = v;
+            }
+            if (!ir_instr_op(c, o, v, writing)) {
+                delete c;
+                return false;
+            }
+        }
+        c->m_bops[0] = in->m_bops[0];
+        c->m_bops[1] = in->m_bops[1];
+        c->m_likely  = in->m_likely;
+        block->m_instr.push_back(c);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        block->m_exits.push_back(to->m_instr.back()->m_bops[i]);
+        to->m_instr.back()->m_bops[i]->m_entries.push_back(block);
+    }
+    ++opts_optimizationcount[OPTIM_BLOCK_LAYOUT];
+    return true;
+}
+
+/* drops the blocks the entry can no longer reach */
+static void ir_function_layout_unreachable(ir_function *self)
+{
+    std::unordered_set<ir_block*> reached;
+    std::vector<ir_block*>        work;
+
+    work.push_back(self->m_blocks[0].get());
+    reached.insert(work.back());
+    while (!work.empty()) {
+        ir_block *block = work.back();
+        work.pop_back();
+        for (auto &e : block->m_exits) {
+            if (reached.insert(e).second)
+                work.push_back(e);
+        }
+    }
+
+    for (auto &bp : self->m_blocks) {
+        ir_block *b = bp.get();
+        if (reached.count(b))
+            continue;
+        for (auto &e : b->m_exits) {
+            if (reached.count(e))
+                ir_block_forget_entry(e, b);
+        }
+        for (auto &in : b->m_instr)
+            ir_instr_remove(in);
+        b->m_instr.clear();
+    }
+    self->m_blocks.erase(std::remove_if(self->m_blocks.begin(), self->m_blocks.end(),
+                                        [&](const std::unique_ptr<ir_block> &b) {
+                                            return !reached.count(b.get());
+                                        }),
+                         self->m_blocks.end());
+}
+
+static bool ir_function_pass_layout(ir_function *self)
+{
+    std::vector<ir_block*> order;
+    std::vector<size_t>    position, idom;
+    bool                   changed = true;
+
+    if (self->m_blocks.empty())
+        return true;
+
+    if (ir_function_layout_thread(self))
+        ir_function_layout_unreachable(self);
+
+    /* the jumps from a block which the target dominates go back into a loop */
+    ir_function_dominators(self, order, position, idom);
+    for (auto &block : order) {
+        ir_instr *last;
+        ir_block *to;
+        size_t    at, p;
+
+        if (block->m_instr.empty() || (last = block->m_instr.back())->m_opcode != VINSTR_JUMP)
+            continue;
+        to = last->m_bops[0];
+        p  = position[block->m_eid];
+        at = position[to->m_eid];
+        if (idom[p] == (size_t)-1 || idom[at] == (size_t)-1 || to == block || !ir_block_layout_copyable(to))
+            continue;
+        while (p > at)
+            p = idom[p];
+        if (p != at)
+            continue;
+        if (!ir_block_layout_copy(block, to))
+            return false;
+    }
+
+    while (changed) {
+        changed = false;
+        for (auto &bp : self->m_blocks) {
+            ir_block *b = bp.get();
+            bool      cold;
+            if (b->m_cold || b->m_instr.empty())
+                continue;
+            if (b->m_instr.back()->m_opcode == VINSTR_NRCALL)
+                cold = true;
+            else {
+                cold = !b->m_exits.empty();
+                for (auto &e : b->m_exits)
+                    cold = cold && e->m_cold;
+            }
+            if (cold)
+                b->m_cold = changed = true;
+        }
+    }
+    /* nothing is out of line in a function which never returns */
+    if (self->m_blocks[0]->m_cold) {
+        for (auto &bp : self->m_blocks)
+            bp->m_cold = false;
+        return true;
+    }
+
+    for (auto &bp : self->m_blocks) {
+        ir_instr *cond;
+        if (bp->m_instr.empty() || (cond = bp->m_instr.back())->m_opcode != VINSTR_COND)
+            continue;
+        if (cond->m_bops[0]->m_cold != cond->m_bops[1]->m_cold)
+            cond->m_likely = cond->m_bops[1]->m_cold;
+    }
+    std::stable_partition(self->m_blocks.begin(), self->m_blocks.end(),
+                          [](const std::unique_ptr<ir_block> &b) { return !b->m_cold; });
+    return true;
+}
+
+bool ir_function_finalize(ir_function *self)
+{
+    if (self->m_builtin)
+        return true;
+
+    self->m_finalized = true;
 
     for (auto& lp : self->m_locals) {
         ir_value *v = lp.get();
@@ -660,6 +2699,48 @@ bool ir_function_finalize(ir_function *self)
         }
     }
 
+    if (OPTS_OPTIMIZATION(OPTIM_SCCP)) {
+        if (!ir_function_pass_sccp(self)) {
+            irerror(self->m_context, "constant propagation broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
+    if (OPTS_OPTIMIZATION(OPTIM_DCE)) {
+        if (!ir_function_pass_dce(self)) {
+            irerror(self->m_context, "dead code elimination broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
+    if (OPTS_OPTIMIZATION(OPTIM_CSE)) {
+        if (!ir_function_pass_cse(self)) {
+            irerror(self->m_context, "common subexpression elimination broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
+    if (OPTS_OPTIMIZATION(OPTIM_LICM)) {
+        if (!ir_function_pass_licm(self)) {
+            irerror(self->m_context, "loop invariant code motion broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
+    if (OPTS_OPTIMIZATION(OPTIM_COPY_PROP)) {
+        if (!ir_function_pass_copyprop(self)) {
+            irerror(self->m_context, "copy propagation broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
+    if (OPTS_OPTIMIZATION(OPTIM_DSE)) {
+        if (!ir_function_pass_dse(self)) {
+            irerror(self->m_context, "dead store elimination broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
     if (OPTS_OPTIMIZATION(OPTIM_PEEPHOLE)) {
         if (!ir_function_pass_peephole(self)) {
             irerror(self->m_context, "generic optimization pass broke something in `%s`", self->m_name.c_str());
@@ -674,11 +2755,21 @@ bool ir_function_finalize(ir_function *self)
         }
     }
 
+    if (OPTS_OPTION_STR(OPTION_PROFILE_USE))
+        ir_function_pass_profile(self);
+
     if (!ir_function_naive_phi(self)) {
         irerror(self->m_context, "internal error: ir_function_naive_phi failed");
         return false;
     }
 
+    if (OPTS_OPTIMIZATION(OPTIM_BLOCK_LAYOUT)) {
+        if (!ir_function_pass_layout(self)) {
+            irerror(self->m_context, "block layout broke something in `%s`", self->m_name.c_str());
+            return false;
+        }
+    }
+
     for (auto& lp : self->m_locals) {
         ir_value *v = lp.get();
         if (v->m_vtype == TYPE_VECTOR ||
@@ -709,6 +2800,175 @@ bool ir_function_finalize(ir_function *self)
     return true;
 }
 
+/*
+ * Dead function stripping
+ * Functions nothing reachable from the entry points refers to are left
+ * out of the program along with everything only they use.  The entry
+ * points are the functions declared along with the system globals, main,
+ * the spawn functions, builtins, functions other globals are initialized
+ * with or point to, and the ones named with -keep.
+ * Spawn functions are the ones named spawnfunc_* and, unless there is a
+ * global named require_spawnfunc_prefix, all others taking no parameters
+ * and returning nothing, like the engine looks them up.
+ */
+static ir_function *ir_value_function(const ir_value *v)
+{
+    if (!v || v->m_vtype != TYPE_FUNCTION || v->m_store != store_global || !v->m_hasvalue)
+        return nullptr;
+    return v->m_constval.vfunc;
+}
+
+static bool ir_function_is_root(ir_builder *ir, const std::unordered_set<std::string> &keep, const ir_function *self)
+{
+    if (self->m_builtin || self->m_name == "main" || keep.count(self->m_name))
+        return true;
+    if (!self->m_name.compare(0, 10, "spawnfunc_"))
+        return true;
+    return self->m_outtype == TYPE_VOID && self->m_params.empty() &&
+           !util_htget(ir->m_htglobals, "require_spawnfunc_prefix");
+}
+
+void ir_builder::stripFunctions(std::vector<ir_function*> &functions)
+{
+    std::unordered_set<std::string>  keep;
+    std::unordered_set<ir_function*> reached;
+    std::vector<ir_function*>        work;
+    size_t                           sys_globals = 0;
+
+    auto reach = [&](ir_function *f) {
+        if (f && reached.insert(f).second)
+            work.push_back(f);
+    };
+
+    if (OPTS_OPTION_STR(OPTION_KEEP)) {
+        const char *names = OPTS_OPTION_STR(OPTION_KEEP);
+        while (*names) {
+            const char *end = strchr(names, ',');
+            if (!end)
+                end = names + strlen(names);
+            keep.emplace(names, end);
+            names = *end ? end + 1 : end;
+        }
+    }
+
+    for (size_t i = 0; i < m_globals.size(); ++i) {
+        if (m_globals[i]->m_vtype == TYPE_VOID && m_globals[i]->m_name == "end_sys_globals")
+            sys_globals = i + 1;
+    }
+    for (size_t i = 0; i < m_globals.size(); ++i) {
+        ir_value    *global = m_globals[i].get();
+        ir_function *f      = ir_value_function(global);
+        if (global->m_vtype == TYPE_POINTER && global->m_hasvalue)
+            reach(ir_value_function(global->m_constval.vpointer));
+        if (f && (i < sys_globals || global != f->m_value || ir_function_is_root(this, keep, f)))
+            reach(f);
+    }
+
+    while (!work.empty()) {
+        ir_function *f = work.back();
+        work.pop_back();
+        for (auto &bp : f->m_blocks) {
+            for (auto &instr : bp->m_instr) {
+                for (size_t op = 0; op < 3; ++op)
+                    reach(ir_value_function(instr->_m_ops[op]));
+                for (auto &it : instr->m_params)
+                    reach(ir_value_function(it));
+                for (auto &it : instr->m_phi)
+                    reach(ir_value_function(it.value));
+            }
+        }
+    }
+
+    /* deleting the instructions drops their uses of the globals as well,
+     * the function's global is left out once nothing reads it
+     */
+    for (auto &fp : m_functions) {
+        ir_function *f = fp.get();
+        if (reached.count(f) || f->m_blocks.empty())
+            continue;
+        f->m_blocks.clear();
+        f->m_first = f->m_last = nullptr;
+        f->m_allocated_locals = f->m_globaltemps = f->m_unshared_temps = 0;
+        f->m_value->m_flags |= IR_FLAG_ERASABLE;
+        ++opts_optimizationcount[OPTIM_STRIP_FUNCTIONS];
+    }
+    functions.erase(std::remove_if(functions.begin(), functions.end(), [&](ir_function *f) {
+        return !reached.count(f);
+    }), functions.end());
+}
+
+/*
+ * Finalizes the functions on a pool of threads.  What a function prints
+ * is held back and passed on in the order of the functions once all of
+ * them are done, up to the first one failing, and the immediates its
+ * passes made join the globals in that order as well, so the output does
+ * not depend on the number of threads.
+ */
+struct ir_finalize_job {
+    ir_function   *function;
+    con_capture_t  output;
+    bool           success;
+};
+
+bool ir_builder::finalize(const std::vector<ir_function*> &functions)
+{
+    std::vector<ir_finalize_job> jobs(functions.size());
+    std::vector<std::thread>     pool;
+    std::atomic<size_t>          next(0);
+    std::atomic<size_t>          failed(functions.size());
+    std::mutex                   merge;
+    unsigned int                *counts  = opts_optimizationcount;
+    size_t                       threads = OPTS_OPTION_U32(OPTION_JOBS);
+
+    for (size_t i = 0; i < functions.size(); ++i)
+        jobs[i].function = functions[i];
+
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (!threads)
+        threads = 1;
+    if (threads > jobs.size())
+        threads = jobs.size();
+    for (size_t t = 0; t < threads; ++t) {
+        ir_arena *arena = new ir_arena;
+        m_thread_arenas.emplace_back(arena);
+        pool.emplace_back([&, arena]() {
+            size_t i;
+            ir_arena::current = arena;
+            while ((i = next++) < jobs.size()) {
+                size_t first = failed;
+                if (i > first)
+                    continue;
+                con_capture(&jobs[i].output);
+                jobs[i].success = ir_function_finalize(jobs[i].function);
+                con_capture(nullptr);
+                while (!jobs[i].success && i < first && !failed.compare_exchange_weak(first, i))
+                    ;
+            }
+            /* the counts are per thread */
+            std::lock_guard<std::mutex> lock(merge);
+            for (size_t o = 0; o < COUNT_OPTIMIZATIONS; ++o)
+                counts[o] += opts_optimizationcount[o];
+        });
+    }
+    for (auto &it : pool)
+        it.join();
+
+    for (auto &it : jobs) {
+        con_replay(it.output);
+        if (!it.success) {
+            con_out("failed to finalize function %s\n", it.function->m_name.c_str());
+            return false;
+        }
+    }
+    for (auto &it : functions) {
+        for (auto &lp : it->m_literals)
+            m_globals.emplace_back(move(lp));
+        it->m_literals.clear();
+    }
+    return true;
+}
+
 ir_value* ir_function_create_local(ir_function *self, const std::string& name, qc_type vtype, bool param)
 {
     ir_value *ve;
@@ -773,18 +3033,12 @@ ir_instr::~ir_instr()
     // gcc doesn't care about an explicit: (void)foo(); to ignore the result,
     // I have to improvise here and use if(foo());
     for (auto &it : m_phi) {
-        size_t idx;
-        if (vec_ir_instr_find(it.value->m_writes, this, &idx))
-            it.value->m_writes.erase(it.value->m_writes.begin() + idx);
-        if (vec_ir_instr_find(it.value->m_reads, this, &idx))
-            it.value->m_reads.erase(it.value->m_reads.begin() + idx);
+        (void)!ir_value_remove_use(it.value->m_writes, it.value, this);
+        (void)!ir_value_remove_use(it.value->m_reads, it.value, this);
     }
     for (auto &it : m_params) {
-        size_t idx;
-        if (vec_ir_instr_find(it->m_writes, this, &idx))
-            it->m_writes.erase(it->m_writes.begin() + idx);
-        if (vec_ir_instr_find(it->m_reads, this, &idx))
-            it->m_reads.erase(it->m_reads.begin() + idx);
+        (void)!ir_value_remove_use(it->m_writes, it, this);
+        (void)!ir_value_remove_use(it->m_reads, it, this);
     }
     (void)!ir_instr_op(this, 0, nullptr, false);
     (void)!ir_instr_op(this, 1, nullptr, false);
@@ -809,18 +3063,12 @@ static bool ir_instr_op(ir_instr *self, int op, ir_value *v, bool writing)
     }
 
     if (self->_m_ops[op]) {
-        size_t idx;
-        if (writing && vec_ir_instr_find(self->_m_ops[op]->m_writes, self, &idx))
-            self->_m_ops[op]->m_writes.erase(self->_m_ops[op]->m_writes.begin() + idx);
-        else if (vec_ir_instr_find(self->_m_ops[op]->m_reads, self, &idx))
-            self->_m_ops[op]->m_reads.erase(self->_m_ops[op]->m_reads.begin() + idx);
-    }
-    if (v) {
-        if (writing)
-            v->m_writes.push_back(self);
-        else
-            v->m_reads.push_back(self);
+        ir_value *old = self->_m_ops[op];
+        if (!writing || !ir_value_remove_use(old->m_writes, old, self))
+            (void)!ir_value_remove_use(old->m_reads, old, self);
     }
+    if (v)
+        ir_value_add_use(writing ? v->m_writes : v->m_reads, v, self);
     self->_m_ops[op] = v;
     return true;
 }
@@ -867,6 +3115,7 @@ ir_value::ir_value(std::string&& name_, store_type store_, qc_type vtype_)
     m_memberof = nullptr;
 
     m_unique_life = false;
+    m_life_index = 0;
     m_locked = false;
     m_callparam  = false;
 }
@@ -894,11 +3143,16 @@ ir_value::~ir_value()
 
 
 /*  helper function */
-ir_value* ir_builder::literalFloat(float value, bool add_to_list) {
-    ir_value *v = new ir_value("#IMMEDIATE", store_global, TYPE_FLOAT);
+static ir_value *ir_value_literal(qc_type vtype) {
+    ir_value *v = new ir_value("#IMMEDIATE", store_global, vtype);
     v->m_flags |= IR_FLAG_ERASABLE;
     v->m_hasvalue = true;
     v->m_cvq = CV_CONST;
+    return v;
+}
+
+ir_value* ir_builder::literalFloat(float value, bool add_to_list) {
+    ir_value *v = ir_value_literal(TYPE_FLOAT);
     v->m_constval.vfloat = value;
 
     m_globals.emplace_back(v);
@@ -909,11 +3163,15 @@ ir_value* ir_builder::literalFloat(float value, bool add_to_list) {
 
 ir_value* ir_value::vectorMember(unsigned int member)
 {
+    std::unique_lock<std::mutex> lock(ir_globals_lock, std::defer_lock);
     std::string name;
     ir_value *m;
     if (member >= 3)
         return nullptr;
 
+    if (m_store == store_global)
+        lock.lock();
+
     if (m_members[member])
         return m_members[member];
 
@@ -1169,60 +3427,6 @@ bool ir_value::mergeLife(const ir_value *other)
     return true;
 }
 
-static bool ir_values_overlap(const ir_value *a, const ir_value *b)
-{
-    /* For any life entry in A see if it overlaps with
-     * any life entry in B.
-     * Note that the life entries are orderes, so we can make a
-     * more efficient algorithm there than naively translating the
-     * statement above.
-     */
-
-    const ir_life_entry_t *la, *lb, *enda, *endb;
-
-    /* first of all, if either has no life range, they cannot clash */
-    if (a->m_life.empty() || b->m_life.empty())
-        return false;
-
-    la = &a->m_life.front();
-    lb = &b->m_life.front();
-    enda = &a->m_life.back() + 1;
-    endb = &b->m_life.back() + 1;
-    while (true)
-    {
-        /* check if the entries overlap, for that,
-         * both must start before the other one ends.
-         */
-        if (la->start < lb->end &&
-            lb->start < la->end)
-        {
-            return true;
-        }
-
-        /* entries are ordered
-         * one entry is earlier than the other
-         * that earlier entry will be moved forward
-         */
-        if (la->start < lb->start)
-        {
-            /* order: A B, move A forward
-             * check if we hit the end with A
-             */
-            if (++la == enda)
-                break;
-        }
-        else /* if (lb->start < la->start)  actually <= */
-        {
-            /* order: B A, move B forward
-             * check if we hit the end with B
-             */
-            if (++lb == endb)
-                break;
-        }
-    }
-    return false;
-}
-
 /***********************************************************************
  *IR main operations
  */
@@ -1447,7 +3651,7 @@ void ir_phi_add(ir_instr* self, ir_block *b, ir_value *v)
 
     pe.value = v;
     pe.from = b;
-    v->m_reads.push_back(self);
+    ir_value_add_use(v->m_reads, v, self);
     self->m_phi.push_back(pe);
 }
 
@@ -1498,7 +3702,7 @@ ir_value* ir_call_value(ir_instr *self)
 void ir_call_param(ir_instr* self, ir_value *v)
 {
     self->m_params.push_back(v);
-    v->m_reads.push_back(self);
+    ir_value_add_use(v->m_reads, v, self);
 }
 
 /* binary op related code */
@@ -1735,6 +3939,35 @@ ir_value* ir_block_create_load_from_ent(ir_block *self, lex_ctx_t ctx, const cha
     return ir_block_create_general_instr(self, ctx, label, op, ent, field, outype);
 }
 
+/* array is the first element of a global array, the others follow it */
+ir_value* ir_block_create_load_from_array(ir_block *self, lex_ctx_t ctx, const char *label, ir_value *array, ir_value *index)
+{
+    int op = (array->m_vtype == TYPE_VECTOR) ? INSTR_LOADA_V : INSTR_LOADA_F;
+    if (array->m_store != store_global || index->m_vtype != TYPE_FLOAT)
+        return nullptr;
+    return ir_block_create_general_instr(self, ctx, label, op, array, index, array->m_vtype);
+}
+
+bool ir_block_create_store_to_array(ir_block *self, lex_ctx_t ctx, ir_value *array, ir_value *index, ir_value *what)
+{
+    ir_instr *in;
+    if (!ir_check_unreachable(self))
+        return false;
+    if (array->m_store != store_global || index->m_vtype != TYPE_FLOAT)
+        return false;
+
+    in = new ir_instr(ctx, self, (array->m_vtype == TYPE_VECTOR) ? INSTR_STOREA_V : INSTR_STOREA_F);
+    if (!ir_instr_op(in, 0, index, false) ||
+        !ir_instr_op(in, 1, what, false) ||
+        !ir_instr_op(in, 2, array, false))
+    {
+        delete in;
+        return false;
+    }
+    self->m_instr.push_back(in);
+    return true;
+}
+
 /* PHI resolving breaks the SSA, and must thus be the last
  * step before life-range calculation.
  */
@@ -1791,11 +4024,9 @@ static bool ir_block_naive_phi(ir_block *self)
 
 /***********************************************************************
  *IR Temp allocation code
- * Propagating value life ranges by walking through the function backwards
- * until no more changes are made.
- * In theory this should happen once more than once for every nested loop
- * level.
- * Though this implementation might run an additional time for if nests.
+ * Propagating value life ranges by walking through the function backwards,
+ * revisiting only the blocks whose successors' living sets changed until
+ * no more changes are made.
  */
 
 /* Enumerate instructions used by value's life-ranges
@@ -1837,79 +4068,149 @@ void ir_function_enumerate(ir_function *self)
  * This is the counterpart to register-allocation in register machines.
  */
 struct function_allocator {
-    std::vector<std::unique_ptr<ir_value>> locals;
     std::vector<size_t> sizes;
     std::vector<size_t> positions;
+    std::vector<size_t> ends;    /* end of the last life placed in a slot */
     std::vector<bool> unique;
 };
 
 static bool function_allocator_alloc(function_allocator *alloc, ir_value *var)
 {
-    ir_value *slot;
-    size_t vsize = var->size();
-
-    var->m_code.local = alloc->locals.size();
+    var->m_code.local = alloc->sizes.size();
 
-    slot = new ir_value("reg", store_global, var->m_vtype);
-    if (!slot)
-        return false;
-
-    if (!slot->mergeLife(var))
-        goto localerror;
-
-    alloc->locals.emplace_back(slot);
-    alloc->sizes.push_back(vsize);
+    alloc->sizes.push_back(var->size());
+    alloc->ends.push_back(var->m_life.empty() ? 0 : var->m_life.back().end);
     alloc->unique.push_back(var->m_unique_life);
-
     return true;
-
-localerror:
-    delete slot;
-    return false;
 }
 
-static bool ir_function_allocator_assign(ir_function *self, function_allocator *alloc, ir_value *v)
+/*
+ * Linear scan over the values ordered by the start of their life. Slots
+ * whose values' lives ended go back to a pool, sorted by size, which the
+ * next values take from before new slots are created.  A value's life
+ * ranges are treated as a single interval from the first start to the
+ * last end.  Like everywhere else ranges touching at their ends do not
+ * overlap.
+ */
+static bool ir_function_allocator_scan(ir_function *self, function_allocator *alloc, std::vector<ir_value *> &values)
 {
+    typedef std::pair<size_t, size_t> life_end; /* end, slot */
+    std::priority_queue<life_end, std::vector<life_end>, std::greater<life_end>> active;
+    std::vector<std::vector<size_t>> pool;   /* free slots by size */
     size_t a;
 
-    if (v->m_unique_life)
-        return function_allocator_alloc(alloc, v);
+    /* the parameters are placed already */
+    for (a = 0; a < alloc->sizes.size(); ++a) {
+        if (!alloc->unique[a])
+            active.emplace(alloc->ends[a], a);
+    }
 
-    for (a = 0; a < alloc->locals.size(); ++a)
-    {
-        /* if it's reserved for a unique liferange: skip */
-        if (alloc->unique[a])
-            continue;
+    std::stable_sort(values.begin(), values.end(), [](const ir_value *x, const ir_value *y) {
+        return x->m_life.front().start < y->m_life.front().start;
+    });
 
-        ir_value *slot = alloc->locals[a].get();
+    for (auto &v : values) {
+        size_t start = v->m_life.front().start;
+        size_t vsize = v->size();
+        size_t best  = 0, fit = 0;
 
-        /* never resize parameters
-         * will be required later when overlapping temps + locals
-         */
-        if (a < self->m_params.size() &&
-            alloc->sizes[a] < v->size())
-        {
-            continue;
+        while (!active.empty() && active.top().first <= start) {
+            size_t slot = active.top().second;
+            active.pop();
+            if (pool.size() <= alloc->sizes[slot])
+                pool.resize(alloc->sizes[slot] + 1);
+            pool[alloc->sizes[slot]].push_back(slot);
         }
 
-        if (ir_values_overlap(v, slot))
-            continue;
+        /* the smallest free slot large enough, else the largest one we may grow */
+        for (size_t s = vsize; s < pool.size() && !fit; ++s) {
+            if (!pool[s].empty())
+                best = s, fit = 1;
+        }
+        for (size_t s = std::min(vsize, pool.size()); s-- > 0 && !fit; ) {
+            /* never resize parameters
+             * will be required later when overlapping temps + locals
+             */
+            for (size_t i = pool[s].size(); i-- > 0; ) {
+                if (pool[s][i] < self->m_params.size())
+                    continue;
+                std::swap(pool[s][i], pool[s].back());
+                best = s, fit = 2;
+                break;
+            }
+        }
 
-        if (!slot->mergeLife(v))
-            return false;
+        if (!fit) {
+            if (!function_allocator_alloc(alloc, v))
+                return false;
+        } else {
+            v->m_code.local = pool[best].back();
+            pool[best].pop_back();
+            if (alloc->sizes[v->m_code.local] < vsize)
+                alloc->sizes[v->m_code.local] = vsize;
+        }
+        alloc->ends[v->m_code.local] = v->m_life.back().end;
+        active.emplace(v->m_life.back().end, v->m_code.local);
+    }
+    return true;
+}
 
-        /* adjust size for this slot */
-        if (alloc->sizes[a] < v->size())
-            alloc->sizes[a] = v->size();
+/*
+ * Temps which do not live across calls may as well use the function's
+ * own local slots while those hold nothing, like a parameter's slot after
+ * its last read.  The function backs these slots up on every call anyway,
+ * so this costs nothing at runtime but leaves fewer temps for the global
+ * temp section all functions share.  Slots are never grown and unique
+ * ones never shared.  `ends` are the ends of the slots placed before the
+ * scan of the `locked` values, which is when a parameter's life ends.
+ */
+static void ir_function_allocator_share(function_allocator *alloc, const std::vector<size_t> &ends,
+                                        const std::vector<ir_value *> &locked, std::vector<ir_value *> &temps)
+{
+    typedef std::pair<size_t, size_t> life_range; /* start, end */
+    std::vector<std::vector<life_range>> busy(alloc->sizes.size());
+    std::vector<ir_value *> rest;
+
+    for (size_t a = 0; a < ends.size(); ++a)
+        busy[a].emplace_back(0, ends[a]);
+    for (auto &v : locked)
+        busy[v->m_code.local].emplace_back(v->m_life.front().start, v->m_life.back().end);
+    for (auto &it : busy)
+        std::sort(it.begin(), it.end());
+
+    std::stable_sort(temps.begin(), temps.end(), [](const ir_value *x, const ir_value *y) {
+        return x->m_life.front().start < y->m_life.front().start;
+    });
+
+    for (auto &v : temps) {
+        life_range life(v->m_life.front().start, v->m_life.back().end);
+        size_t     best = busy.size();
+        size_t     at   = 0;
+
+        for (size_t slot = 0; slot < busy.size(); ++slot) {
+            if (alloc->unique[slot] || alloc->sizes[slot] < v->size())
+                continue;
+            if (best < busy.size() && alloc->sizes[best] <= alloc->sizes[slot])
+                continue;
+            /* the lives in a slot do not overlap, so only the last one
+             * starting before this one ends may still be alive
+             */
+            auto next = std::lower_bound(busy[slot].begin(), busy[slot].end(), life_range(life.second, 0));
+            if (next != busy[slot].begin() && (next-1)->second > life.first)
+                continue;
+            best = slot;
+            at   = next - busy[slot].begin();
+        }
 
-        v->m_code.local = a;
-        return true;
-    }
-    if (a >= alloc->locals.size()) {
-        if (!function_allocator_alloc(alloc, v))
-            return false;
+        if (best == busy.size()) {
+            rest.push_back(v);
+            continue;
+        }
+        busy[best].insert(busy[best].begin() + at, life);
+        v->m_code.local = best;
+        v->m_locked     = true;
     }
-    return true;
+    temps.swap(rest);
 }
 
 bool ir_function_allocate_locals(ir_function *self)
@@ -1918,6 +4219,7 @@ bool ir_function_allocate_locals(ir_function *self)
     bool   opt_gt = OPTS_OPTIMIZATION(OPTIM_GLOBAL_TEMPS);
 
     function_allocator lockalloc, globalloc;
+    std::vector<ir_value *> lockscan, globalscan;
 
     if (self->m_locals.empty() && self->m_values.empty())
         return true;
@@ -1942,8 +4244,12 @@ bool ir_function_allocate_locals(ir_function *self)
         ir_value *v = self->m_locals[i].get();
         if (v->m_life.empty())
             continue;
-        if (!ir_function_allocator_assign(self, (v->m_locked || !opt_gt ? &lockalloc : &globalloc), v))
-            return false;
+        if (v->m_unique_life) {
+            if (!function_allocator_alloc((v->m_locked || !opt_gt ? &lockalloc : &globalloc), v))
+                return false;
+        }
+        else
+            (v->m_locked || !opt_gt ? lockscan : globalscan).push_back(v);
     }
 
     /* Allocate a slot for any value that still exists */
@@ -1976,16 +4282,19 @@ bool ir_function_allocate_locals(ir_function *self)
                 if (param < 8)
                     v->setCodeAddress(OFS_PARM0 + 3*param);
                 else {
-                    size_t nprotos = self->m_owner->m_extparam_protos.size();
                     ir_value *ep;
                     param -= 8;
-                    if (nprotos > param)
-                        ep = self->m_owner->m_extparam_protos[param].get();
-                    else
                     {
-                        ep = self->m_owner->generateExtparamProto();
-                        while (++nprotos <= param)
+                        std::lock_guard<std::mutex> lock(ir_globals_lock);
+                        size_t nprotos = self->m_owner->m_extparam_protos.size();
+                        if (nprotos > param)
+                            ep = self->m_owner->m_extparam_protos[param].get();
+                        else
+                        {
                             ep = self->m_owner->generateExtparamProto();
+                            while (++nprotos <= param)
+                                ep = self->m_owner->generateExtparamProto();
+                        }
                     }
                     ir_instr_op(v->m_writes[0], 0, ep, true);
                     call->m_params[param+8] = ep;
@@ -2002,10 +4311,32 @@ bool ir_function_allocate_locals(ir_function *self)
             }
         }
 
-        if (!ir_function_allocator_assign(self, (v->m_locked || !opt_gt ? &lockalloc : &globalloc), v))
+        if (v->m_unique_life) {
+            if (!function_allocator_alloc((v->m_locked || !opt_gt ? &lockalloc : &globalloc), v))
+                return false;
+        }
+        else
+            (v->m_locked || !opt_gt ? lockscan : globalscan).push_back(v);
+    }
+
+    std::vector<size_t> placed = lockalloc.ends;
+    if (!ir_function_allocator_scan(self, &lockalloc, lockscan))
+        return false;
+
+    if (opt_gt && OPTS_OPTIMIZATION(OPTIM_OVERLAP_TEMPS) && !globalscan.empty()) {
+        /* remember what the temps would take without sharing */
+        function_allocator unshared = globalloc;
+        std::vector<ir_value *> temps = globalscan;
+        if (!ir_function_allocator_scan(self, &unshared, temps))
             return false;
+        for (auto &size : unshared.sizes)
+            self->m_unshared_temps += size;
+        ir_function_allocator_share(&lockalloc, placed, lockscan, globalscan);
     }
 
+    if (!ir_function_allocator_scan(self, &globalloc, globalscan))
+        return false;
+
     if (lockalloc.sizes.empty() && globalloc.sizes.empty())
         return true;
 
@@ -2079,6 +4410,8 @@ static void ir_op_read_write(int op, size_t *read, size_t *write)
     case INSTR_STOREP_ENT:
     case INSTR_STOREP_FLD:
     case INSTR_STOREP_FNC:
+    case INSTR_STOREA_F:
+    case INSTR_STOREA_V:
         *write = 0;
         *read  = 7;
         break;
@@ -2089,40 +4422,133 @@ static void ir_op_read_write(int op, size_t *read, size_t *write)
     };
 }
 
-static bool ir_block_living_add_instr(ir_block *self, size_t eid) {
-    bool changed = false;
-    for (auto &it : self->m_living)
-        if (it->setAlive(eid))
-            changed = true;
-    return changed;
+static void ir_block_living_add_instr(ir_block *self, size_t eid) {
+    std::vector<ir_value *> &values = self->m_owner->m_life_values;
+    self->m_living.each([&](size_t i) {
+        values[i]->setAlive(eid);
+    });
 }
 
-static bool ir_block_living_lock(ir_block *self) {
-    bool changed = false;
-    for (auto &it : self->m_living) {
-        if (it->m_locked)
+static void ir_block_living_lock(ir_block *self) {
+    std::vector<ir_value *> &values = self->m_owner->m_life_values;
+    self->m_living.each([&](size_t i) {
+        values[i]->m_locked = true;
+    });
+}
+
+/* reading a value keeps it alive along with the full vector */
+static void ir_block_living_read(ir_block *self, ir_value *value)
+{
+    if (value->m_store == store_global)
+        return;
+    self->m_living.set(value->m_life_index);
+    if (value->m_memberof)
+        self->m_living.set(value->m_memberof->m_life_index);
+    for (size_t mem = 0; mem < 3; ++mem) {
+        if (value->m_members[mem])
+            self->m_living.set(value->m_members[mem]->m_life_index);
+    }
+}
+
+/*
+ * Orders the blocks of a function in reverse post-order of a depth first
+ * walk from the entry, followed by the blocks it cannot reach.
+ */
+static void ir_function_block_order(ir_function *self, std::vector<ir_block *> &order)
+{
+    std::vector<std::pair<ir_block *, size_t>> stack;
+    std::vector<bool> seen(self->m_blocks.size(), false);
+
+    order.clear();
+    if (self->m_blocks.empty())
+        return;
+
+    stack.emplace_back(self->m_blocks[0].get(), 0);
+    seen[self->m_blocks[0]->m_eid] = true;
+    while (!stack.empty()) {
+        ir_block *block = stack.back().first;
+        size_t   &next  = stack.back().second;
+        if (next < block->m_exits.size()) {
+            ir_block *to = block->m_exits[next++];
+            if (!seen[to->m_eid]) {
+                seen[to->m_eid] = true;
+                stack.emplace_back(to, 0);
+            }
             continue;
-        it->m_locked = true;
-        changed = true;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+
+    for (auto &bp : self->m_blocks) {
+        if (!seen[bp->m_eid])
+            order.push_back(bp.get());
+    }
+}
+
+/*
+ * Worklist solver for dataflow problems over the blocks of a function.
+ * transfer() recomputes the state of a block from its neighbours and
+ * returns whether it changed, in which case the blocks depending on it
+ * are visited again: the successors of a forward problem, the
+ * predecessors of a backward one.  Pending blocks are visited in reverse
+ * post-order, or post-order for backward problems, so most of them see
+ * their final input the first time.  Every block is visited at least
+ * once.  Needs the block numbering of ir_function_enumerate.
+ */
+template<typename TRANSFER>
+static void ir_function_solve_dataflow(ir_function *self, bool backward, TRANSFER transfer)
+{
+    std::vector<ir_block *> order;
+    std::vector<size_t>     position(self->m_blocks.size());
+    std::vector<bool>       pending(self->m_blocks.size(), true);
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> work;
+
+    ir_function_block_order(self, order);
+    if (backward)
+        std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) {
+        position[order[i]->m_eid] = i;
+        work.push(i);
+    }
+
+    while (!work.empty()) {
+        ir_block *block = order[work.top()];
+        work.pop();
+        pending[block->m_eid] = false;
+        if (!transfer(block))
+            continue;
+        for (auto &it : backward ? block->m_entries : block->m_exits) {
+            if (pending[it->m_eid])
+                continue;
+            pending[it->m_eid] = true;
+            work.push(position[it->m_eid]);
+        }
     }
-    return changed;
 }
 
-static bool ir_block_life_propagate(ir_block *self, bool *changed)
+/*
+ * Computes the values living at the start of the block from the ones
+ * living at the start of its successors and extends their life ranges
+ * over it.  Returns whether the set changed.
+ */
+static bool ir_block_life_propagate(ir_block *self)
 {
     ir_instr *instr;
     ir_value *value;
     size_t i, o, mem;
     // bitmasks which operands are read from or written to
     size_t read, write;
+    bool emulated = OPTS_OPTION_U32(OPTION_TARGET) != TARGET_GMQCC_EXT;
+    ir_bitset before = self->m_living;
 
-    self->m_living.clear();
+    self->m_owner->m_run_id++;
 
-    for (auto &prev : self->m_exits) {
-        for (auto &it : prev->m_living)
-            if (!vec_ir_value_find(self->m_living, it, nullptr))
-                self->m_living.push_back(it);
-    }
+    /* a block looping onto itself reads its own previous state */
+    self->m_living.clear();
+    for (auto &prev : self->m_exits)
+        self->m_living.merge(prev == self ? before : prev->m_living);
 
     i = self->m_instr.size();
     while (i)
@@ -2157,49 +4583,38 @@ static bool ir_block_life_propagate(ir_block *self, bool *changed)
              */
             if (write & (1<<o))
             {
-                size_t idx;
-                bool in_living = vec_ir_value_find(self->m_living, value, &idx);
-                if (!in_living)
-                {
-                    /* If the value isn't alive it hasn't been read before... */
-                    /* TODO: See if the warning can be emitted during parsing or AST processing
-                     * otherwise have warning printed here.
-                     * IF printing a warning here: include filecontext_t,
-                     * and make sure it's only printed once
-                     * since this function is run multiple times.
-                     */
-                    /* con_err( "Value only written %s\n", value->m_name); */
-                    if (value->setAlive(instr->m_eid))
-                        *changed = true;
-                } else {
-                    /* since 'living' won't contain it
-                     * anymore, merge the value, since
-                     * (A) doesn't.
-                     */
-                    if (value->setAlive(instr->m_eid))
-                        *changed = true;
-                    // Then remove
-                    self->m_living.erase(self->m_living.begin() + idx);
-                }
+                /* If the value isn't alive it hasn't been read before... */
+                /* TODO: See if the warning can be emitted during parsing or AST processing
+                 * otherwise have warning printed here.
+                 * IF printing a warning here: include filecontext_t,
+                 * and make sure it's only printed once
+                 * since this function is run multiple times.
+                 */
+                /* con_err( "Value only written %s\n", value->m_name); */
+                /* since 'living' won't contain it
+                 * anymore, merge the value, since
+                 * (A) doesn't.
+                 */
+                value->setAlive(instr->m_eid);
+                // Then remove
+                self->m_living.reset(value->m_life_index);
                 /* Removing a vector removes all members */
                 for (mem = 0; mem < 3; ++mem) {
-                    if (value->m_members[mem] && vec_ir_value_find(self->m_living, value->m_members[mem], &idx)) {
-                        if (value->m_members[mem]->setAlive(instr->m_eid))
-                            *changed = true;
-                        self->m_living.erase(self->m_living.begin() + idx);
+                    if (value->m_members[mem] && self->m_living.test(value->m_members[mem]->m_life_index)) {
+                        value->m_members[mem]->setAlive(instr->m_eid);
+                        self->m_living.reset(value->m_members[mem]->m_life_index);
                     }
                 }
                 /* Removing the last member removes the vector */
                 if (value->m_memberof) {
                     value = value->m_memberof;
                     for (mem = 0; mem < 3; ++mem) {
-                        if (value->m_members[mem] && vec_ir_value_find(self->m_living, value->m_members[mem], nullptr))
+                        if (value->m_members[mem] && self->m_living.test(value->m_members[mem]->m_life_index))
                             break;
                     }
-                    if (mem == 3 && vec_ir_value_find(self->m_living, value, &idx)) {
-                        if (value->setAlive(instr->m_eid))
-                            *changed = true;
-                        self->m_living.erase(self->m_living.begin() + idx);
+                    if (mem == 3 && self->m_living.test(value->m_life_index)) {
+                        value->setAlive(instr->m_eid);
+                        self->m_living.reset(value->m_life_index);
                     }
                 }
             }
@@ -2207,36 +4622,39 @@ static bool ir_block_life_propagate(ir_block *self, bool *changed)
 
         /* These operations need a special case as they can break when using
          * same source and destination operand otherwise, as the engine may
-         * read the source multiple times. */
+         * read the source multiple times. The extended target's instructions
+         * read all their sources first. */
         if (instr->m_opcode == INSTR_MUL_VF ||
-            instr->m_opcode == VINSTR_BITAND_VF ||
-            instr->m_opcode == VINSTR_BITOR_VF ||
-            instr->m_opcode == VINSTR_BITXOR ||
-            instr->m_opcode == VINSTR_BITXOR_VF ||
-            instr->m_opcode == VINSTR_BITXOR_V ||
-            instr->m_opcode == VINSTR_CROSS)
+            (emulated && (instr->m_opcode == VINSTR_BITAND_VF ||
+                          instr->m_opcode == VINSTR_BITOR_VF ||
+                          instr->m_opcode == VINSTR_BITXOR ||
+                          instr->m_opcode == VINSTR_BITXOR_VF ||
+                          instr->m_opcode == VINSTR_BITXOR_V ||
+                          instr->m_opcode == VINSTR_CROSS)))
         {
             value = instr->_m_ops[2];
             /* the float source will get an additional lifetime */
-            if (value->setAlive(instr->m_eid+1))
-                *changed = true;
-            if (value->m_memberof && value->m_memberof->setAlive(instr->m_eid+1))
-                *changed = true;
+            if (value->m_store != store_global) {
+                value->setAlive(instr->m_eid+1);
+                if (value->m_memberof)
+                    value->m_memberof->setAlive(instr->m_eid+1);
+            }
         }
 
         if (instr->m_opcode == INSTR_MUL_FV ||
             instr->m_opcode == INSTR_LOAD_V ||
-            instr->m_opcode == VINSTR_BITXOR ||
-            instr->m_opcode == VINSTR_BITXOR_VF ||
-            instr->m_opcode == VINSTR_BITXOR_V ||
-            instr->m_opcode == VINSTR_CROSS)
+            (emulated && (instr->m_opcode == VINSTR_BITXOR ||
+                          instr->m_opcode == VINSTR_BITXOR_VF ||
+                          instr->m_opcode == VINSTR_BITXOR_V ||
+                          instr->m_opcode == VINSTR_CROSS)))
         {
             value = instr->_m_ops[1];
             /* the float source will get an additional lifetime */
-            if (value->setAlive(instr->m_eid+1))
-                *changed = true;
-            if (value->m_memberof && value->m_memberof->setAlive(instr->m_eid+1))
-                *changed = true;
+            if (value->m_store != store_global) {
+                value->setAlive(instr->m_eid+1);
+                if (value->m_memberof)
+                    value->m_memberof->setAlive(instr->m_eid+1);
+            }
         }
 
         for (o = 0; o < 3; ++o)
@@ -2256,60 +4674,67 @@ static bool ir_block_life_propagate(ir_block *self, bool *changed)
 
             /* read operands */
             if (read & (1<<o))
-            {
-                if (!vec_ir_value_find(self->m_living, value, nullptr))
-                    self->m_living.push_back(value);
-                /* reading adds the full vector */
-                if (value->m_memberof && !vec_ir_value_find(self->m_living, value->m_memberof, nullptr))
-                    self->m_living.push_back(value->m_memberof);
-                for (mem = 0; mem < 3; ++mem) {
-                    if (value->m_members[mem] && !vec_ir_value_find(self->m_living, value->m_members[mem], nullptr))
-                        self->m_living.push_back(value->m_members[mem]);
-                }
-            }
+                ir_block_living_read(self, value);
         }
         /* PHI operands are always read operands */
-        for (auto &it : instr->m_phi) {
-            value = it.value;
-            if (!vec_ir_value_find(self->m_living, value, nullptr))
-                self->m_living.push_back(value);
-            /* reading adds the full vector */
-            if (value->m_memberof && !vec_ir_value_find(self->m_living, value->m_memberof, nullptr))
-                self->m_living.push_back(value->m_memberof);
-            for (mem = 0; mem < 3; ++mem) {
-                if (value->m_members[mem] && !vec_ir_value_find(self->m_living, value->m_members[mem], nullptr))
-                    self->m_living.push_back(value->m_members[mem]);
-            }
-        }
+        for (auto &it : instr->m_phi)
+            ir_block_living_read(self, it.value);
 
         /* on a call, all these values must be "locked" */
-        if (instr->m_opcode >= INSTR_CALL0 && instr->m_opcode <= INSTR_CALL8) {
-            if (ir_block_living_lock(self))
-                *changed = true;
-        }
+        if (instr->m_opcode >= INSTR_CALL0 && instr->m_opcode <= INSTR_CALL8)
+            ir_block_living_lock(self);
         /* call params are read operands too */
-        for (auto &it : instr->m_params) {
-            value = it;
-            if (!vec_ir_value_find(self->m_living, value, nullptr))
-                self->m_living.push_back(value);
-            /* reading adds the full vector */
-            if (value->m_memberof && !vec_ir_value_find(self->m_living, value->m_memberof, nullptr))
-                self->m_living.push_back(value->m_memberof);
-            for (mem = 0; mem < 3; ++mem) {
-                if (value->m_members[mem] && !vec_ir_value_find(self->m_living, value->m_members[mem], nullptr))
-                    self->m_living.push_back(value->m_members[mem]);
-            }
-        }
+        for (auto &it : instr->m_params)
+            ir_block_living_read(self, it);
 
         /* (A) */
-        if (ir_block_living_add_instr(self, instr->m_eid))
-            *changed = true;
+        ir_block_living_add_instr(self, instr->m_eid);
     }
     /* the "entry" instruction ID */
-    if (ir_block_living_add_instr(self, self->m_entry_id))
-        *changed = true;
+    ir_block_living_add_instr(self, self->m_entry_id);
 
-    return true;
+    return self->m_living.m_words != before.m_words;
+}
+
+/*
+ * Number every value the life propagation may see densely, so the
+ * living sets can be bitsets.  Globals are left out: nothing is allocated
+ * for them, and other functions are finalized at the same time.
+ */
+static void ir_function_number_value(ir_function *self, ir_value *value)
+{
+    if (value->m_store == store_global)
+        return;
+    if (value->m_life_index < self->m_life_values.size() &&
+        self->m_life_values[value->m_life_index] == value)
+        return;
+    value->m_life_index = self->m_life_values.size();
+    self->m_life_values.push_back(value);
+    if (value->m_memberof)
+        ir_function_number_value(self, value->m_memberof);
+    for (size_t mem = 0; mem < 3; ++mem) {
+        if (value->m_members[mem])
+            ir_function_number_value(self, value->m_members[mem]);
+    }
+}
+
+static void ir_function_number_values(ir_function *self)
+{
+    self->m_life_values.clear();
+    for (auto &bp : self->m_blocks) {
+        for (auto &instr : bp->m_instr) {
+            for (size_t o = 0; o < 3; ++o) {
+                if (instr->_m_ops[o])
+                    ir_function_number_value(self, instr->_m_ops[o]);
+            }
+            for (auto &it : instr->m_phi)
+                ir_function_number_value(self, it.value);
+            for (auto &it : instr->m_params)
+                ir_function_number_value(self, it);
+        }
+    }
+    for (auto &bp : self->m_blocks)
+        bp->m_living.resize(self->m_life_values.size());
 }
 
 bool ir_function_calculate_liferanges(ir_function *self)
@@ -2319,23 +4744,25 @@ bool ir_function_calculate_liferanges(ir_function *self)
         if (!self->m_locals[i].get()->setAlive(0))
             compile_error(self->m_context, "internal error: failed value-life merging");
 
-    bool changed;
-    do {
-        self->m_run_id++;
-        changed = false;
-        for (auto i = self->m_blocks.rbegin(); i != self->m_blocks.rend(); ++i)
-            ir_block_life_propagate(i->get(), &changed);
-    } while (changed);
+    ir_function_number_values(self);
+
+    ir_function_solve_dataflow(self, true, ir_block_life_propagate);
 
     if (self->m_blocks.size()) {
-        ir_block *block = self->m_blocks[0].get();
-        for (auto &it : block->m_living) {
+        std::vector<ir_value *> living;
+        self->m_blocks[0]->m_living.each([&](size_t i) {
+            living.push_back(self->m_life_values[i]);
+        });
+        for (auto &it : living) {
             ir_value *v = it;
             if (v->m_store != store_local)
                 continue;
             if (v->m_vtype == TYPE_VECTOR)
                 continue;
             self->m_flags |= IR_FLAG_HAS_UNINITIALIZED;
+            /* already reported for the inlined function */
+            if (v->m_flags & IR_FLAG_INLINED)
+                continue;
             /* find the instruction reading from it */
             size_t s = 0;
             for (; s < v->m_reads.size(); ++s) {
@@ -2469,6 +4896,48 @@ static bool gen_global_pointer(code_t *code, ir_value *global)
     return true;
 }
 
+/* Replaces a conditional jump over the single statement following it
+ * with that statement. Blocks which started behind the conditional jump
+ * move along, or jumps generated later on would skip a statement.
+ */
+static void gen_blocks_collapse_jump(code_t *code, ir_function *func, size_t stidx)
+{
+    code->statements[stidx] = code->statements[stidx+1];
+    if (code->statements[stidx].o1.s1 < 0)
+        code->statements[stidx].o1.s1++;
+    code_pop_statement(code);
+    for (auto &bp : func->m_blocks) {
+        if (bp->m_generated && bp->m_code_start > stidx)
+            --bp->m_code_start;
+    }
+    for (auto &it : func->m_cold_jumps) {
+        if (it.first > stidx)
+            --it.first;
+    }
+}
+
+/*
+ * On the extended target a call whose result is returned right away
+ * becomes a TAILCALL, which executes the callee in place of the caller.
+ */
+static bool gen_call_is_tail(ir_block *block, size_t i)
+{
+    ir_instr *call = block->m_instr[i];
+    ir_instr *ret;
+
+    if (!OPTS_OPTIMIZATION(OPTIM_TAIL_CALLS) ||
+        OPTS_OPTION_U32(OPTION_TARGET) != TARGET_GMQCC_EXT)
+        return false;
+    if (call->m_opcode < INSTR_CALL0 || call->m_opcode > INSTR_CALL8 ||
+        i+2 != block->m_instr.size())
+        return false;
+
+    ret = block->m_instr[i+1];
+    if (ret->m_opcode != INSTR_RETURN && ret->m_opcode != INSTR_DONE)
+        return false;
+    return !ret->_m_ops[0] || ret->_m_ops[0] == call->_m_ops[0];
+}
+
 static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *block)
 {
     prog_section_statement_t stmt;
@@ -2511,6 +4980,20 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
             return true;
         }
 
+        /* the extended target has a real instruction for each of these */
+        if (OPTS_OPTION_U32(OPTION_TARGET) == TARGET_GMQCC_EXT &&
+            instr->m_opcode >= VINSTR_BITAND_V && instr->m_opcode <= VINSTR_CROSS)
+        {
+            stmt.opcode = INSTR_BITAND_V + (instr->m_opcode - VINSTR_BITAND_V);
+            stmt.o1.s1 = instr->_m_ops[1]->codeAddress();
+            stmt.o2.s1 = instr->_m_ops[2]->codeAddress();
+            stmt.o3.s1 = instr->_m_ops[0]->codeAddress();
+            code_push_statement(code, &stmt, instr->m_context);
+
+            /* instruction generated */
+            continue;
+        }
+
         if (instr->m_opcode == VINSTR_BITXOR) {
             stmt.opcode = INSTR_BITOR;
             stmt.o1.s1 = instr->_m_ops[1]->codeAddress();
@@ -2689,6 +5172,15 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
                 if (stmt.o2.s1 != 1)
                     code_push_statement(code, &stmt, instr->m_context);
             }
+            if (ontrue->m_generated && onfalse->m_generated) {
+                /* a threaded jump may lead back into both paths */
+                stmt.opcode = INSTR_GOTO;
+                stmt.o1.s1 = onfalse->m_code_start - code->statements.size();
+                stmt.o2.s1 = 0;
+                stmt.o3.s1 = 0;
+                code_push_statement(code, &stmt, instr->m_context);
+                return true;
+            }
             if (onfalse->m_generated) {
                 stmt.opcode = INSTR_IFNOT;
                 stmt.o2.s1 = onfalse->m_code_start - code->statements.size();
@@ -2714,6 +5206,11 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
             }
             stidx = code->statements.size();
             code_push_statement(code, &stmt, instr->m_context);
+            /* cold paths are generated after the rest of the function */
+            if (onfalse->m_cold && !ontrue->m_cold) {
+                func->m_cold_jumps.emplace_back(stidx, onfalse);
+                return gen_blocks_recursive(code, func, ontrue);
+            }
             /* on false we jump, so add ontrue-path */
             if (!gen_blocks_recursive(code, func, ontrue))
                 return false;
@@ -2724,16 +5221,14 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
                 /* fixup the jump address */
                 code->statements[stidx].o2.s1 = onfalse->m_code_start - stidx;
                 if (stidx+2 == code->statements.size() && code->statements[stidx].o2.s1 == 1) {
-                    code->statements[stidx] = code->statements[stidx+1];
-                    if (code->statements[stidx].o1.s1 < 0)
-                        code->statements[stidx].o1.s1++;
-                    code_pop_statement(code);
+                    gen_blocks_collapse_jump(code, func, stidx);
                 }
                 stmt.opcode = code->statements.back().opcode;
                 if (stmt.opcode == INSTR_GOTO ||
                     stmt.opcode == INSTR_IF ||
                     stmt.opcode == INSTR_IFNOT ||
                     stmt.opcode == INSTR_RETURN ||
+                    stmt.opcode == INSTR_TAILCALL ||
                     stmt.opcode == INSTR_DONE)
                 {
                     /* no use jumping from here */
@@ -2749,10 +5244,7 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
                 return true;
             }
             else if (stidx+2 == code->statements.size() && code->statements[stidx].o2.s1 == 1) {
-                code->statements[stidx] = code->statements[stidx+1];
-                if (code->statements[stidx].o1.s1 < 0)
-                    code->statements[stidx].o1.s1++;
-                code_pop_statement(code);
+                gen_blocks_collapse_jump(code, func, stidx);
             }
             /* if not, generate now */
             return gen_blocks_recursive(code, func, onfalse);
@@ -2849,6 +5341,15 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
             stmt.o1.u1 = instr->_m_ops[1]->codeAddress();
             stmt.o2.u1 = 0;
             stmt.o3.u1 = 0;
+
+            /* the callee's RETURN ends the caller as well */
+            if (gen_call_is_tail(block, i)) {
+                stmt.o2.u1 = stmt.opcode - INSTR_CALL0;
+                stmt.opcode = INSTR_TAILCALL;
+                code_push_statement(code, &stmt, instr->m_context);
+                ++opts_optimizationcount[OPTIM_TAIL_CALLS];
+                return true;
+            }
             code_push_statement(code, &stmt, instr->m_context);
 
             retvalue = instr->_m_ops[0];
@@ -2944,6 +5445,15 @@ static bool gen_function_code(code_t *code, ir_function *self)
         irerror(self->m_context, "failed to generate blocks for '%s'", self->m_name.c_str());
         return false;
     }
+    for (size_t i = 0; i < self->m_cold_jumps.size(); ++i) {
+        block = self->m_cold_jumps[i].second;
+        if (!block->m_generated && !gen_blocks_recursive(code, self, block)) {
+            irerror(self->m_context, "failed to generate blocks for '%s'", self->m_name.c_str());
+            return false;
+        }
+        code->statements[self->m_cold_jumps[i].first].o2.s1 = block->m_code_start - self->m_cold_jumps[i].first;
+    }
+    self->m_cold_jumps.clear();
 
     /* code_write and qcvm -disasm need to know that the function ends here */
     retst = &code->statements.back();
@@ -3401,7 +5911,7 @@ bool ir_builder::generateGlobal(ir_value *global, bool islocal)
     {
         global->setCodeAddress(m_code->globals.size());
         if (global->m_hasvalue) {
-            if (global->m_cvq == CV_CONST && global->m_reads.empty())
+            if (global->m_cvq == CV_CONST && global->m_reads.empty() && !(global->m_flags & IR_FLAG_INDEXED))
                 return true;
             iptr = (int32_t*)&global->m_constval.ivec[0];
             m_code->globals.push_back(*iptr);
@@ -3419,7 +5929,7 @@ bool ir_builder::generateGlobal(ir_value *global, bool islocal)
     {
         global->setCodeAddress(m_code->globals.size());
         if (global->m_hasvalue) {
-            if (global->m_cvq == CV_CONST && global->m_reads.empty())
+            if (global->m_cvq == CV_CONST && global->m_reads.empty() && !(global->m_flags & IR_FLAG_INDEXED))
                 return true;
             uint32_t load = code_genstring(m_code.get(), global->m_constval.vstring);
             m_code->globals.push_back(load);
@@ -3498,6 +6008,103 @@ static GMQCC_INLINE void ir_builder_prepare_field(code_t *code, ir_value *field)
     field->m_code.fieldaddr = code_alloc_field(code, type_sizeof_[field->m_fieldtype]);
 }
 
+/*
+ * Entity field layout
+ * Past the fields declared up to `end_sys_fields`, which the engine
+ * accesses by offset, fields nothing uses are left out and the others are
+ * ordered by how often they are used, so an entity's hot fields share its
+ * first cache lines.  Uses are weighted with the profile when there is
+ * one.  Field arrays move as a whole and, like the fields the VM looks up
+ * for OP_STATE, are always kept.
+ */
+struct ir_field_unit {
+    size_t   first;
+    size_t   count;
+    uint64_t runs; /* profiled executions of the statements using it */
+    uint64_t uses; /* statements using it */
+};
+
+static void ir_field_count_uses(const ir_value *field, ir_field_unit *unit)
+{
+    const ir_value *values[] = { field, field->m_members[0], field->m_members[1], field->m_members[2] };
+    for (const ir_value *v : values) {
+        if (!v)
+            continue;
+        for (const ir_instr *instr : v->m_reads) {
+            unit->runs += profile_line(instr->m_owner->m_owner->m_name.c_str(), instr->m_context.line);
+            ++unit->uses;
+        }
+        for (const ir_instr *instr : v->m_writes) {
+            unit->runs += profile_line(instr->m_owner->m_owner->m_name.c_str(), instr->m_context.line);
+            ++unit->uses;
+        }
+    }
+}
+
+static bool ir_field_unused(const std::unordered_set<const ir_value*> &pointees, const ir_value *field)
+{
+    if (!OPTS_OPTIMIZATION(OPTIM_STRIP_FIELDS))
+        return false;
+    if (field->m_flags & (IR_FLAG_INCLUDE_DEF | IR_FLAG_NOREF) || field->m_locked || pointees.count(field))
+        return false;
+    if (field->m_name == "think" || field->m_name == "nextthink" || field->m_name == "frame")
+        return false;
+    if (!field->m_reads.empty() || !field->m_writes.empty())
+        return false;
+    for (size_t mem = 0; mem < 3; ++mem) {
+        const ir_value *m = field->m_members[mem];
+        if (m && (!m->m_reads.empty() || !m->m_writes.empty()))
+            return false;
+    }
+    return true;
+}
+
+static void ir_builder_layout_fields(ir_builder *self, std::vector<bool> &unused)
+{
+    std::unordered_set<const ir_value*> pointees;
+    std::vector<ir_field_unit>          units;
+    const size_t                        sys_fields = std::min(self->m_sys_fields, self->m_fields.size());
+
+    for (auto &gp : self->m_globals) {
+        if (gp->m_vtype == TYPE_FIELD && gp->m_hasvalue)
+            pointees.insert(gp->m_constval.vpointer);
+    }
+
+    unused.assign(self->m_fields.size(), false);
+    for (size_t i = 0; i < sys_fields; ++i)
+        ir_builder_prepare_field(self->m_code.get(), self->m_fields[i].get());
+
+    for (size_t i = sys_fields; i < self->m_fields.size(); ++i) {
+        ir_value *field = self->m_fields[i].get();
+        if (ir_field_unused(pointees, field)) {
+            opts_optimizationcount[OPTIM_STRIP_FIELDS] += type_sizeof_[field->m_fieldtype];
+            unused[i] = true;
+            continue;
+        }
+        /* the elements of a field array follow its first one */
+        if (field->m_locked && !units.empty() && field->m_name.find('[') != std::string::npos)
+            ++units.back().count;
+        else
+            units.push_back({ i, 1, 0, 0 });
+        ir_field_count_uses(field, &units.back());
+    }
+
+    std::vector<ir_field_unit> sorted(units);
+    if (OPTS_OPTIMIZATION(OPTIM_SORT_FIELDS)) {
+        std::stable_sort(sorted.begin(), sorted.end(), [](const ir_field_unit &a, const ir_field_unit &b) {
+            if (a.runs != b.runs)
+                return a.runs > b.runs;
+            return a.uses > b.uses;
+        });
+    }
+    for (size_t u = 0; u < sorted.size(); ++u) {
+        if (sorted[u].first != units[u].first)
+            opts_optimizationcount[OPTIM_SORT_FIELDS] += sorted[u].count;
+        for (size_t i = sorted[u].first; i < sorted[u].first + sorted[u].count; ++i)
+            ir_builder_prepare_field(self->m_code.get(), self->m_fields[i].get());
+    }
+}
+
 static bool ir_builder_gen_field(ir_builder *self, ir_value *field)
 {
     prog_section_def_t def;
@@ -3587,6 +6194,9 @@ static void ir_builder_split_vector(ir_builder *self, ir_value *vec) {
     // must not be written to
     if (vec->m_writes.size())
         return;
+    // must stay in place for indexed access
+    if (vec->m_flags & IR_FLAG_INDEXED)
+        return;
     // must not be trying to access individual members
     if (vec->m_members[0] || vec->m_members[1] || vec->m_members[2])
         return;
@@ -3660,6 +6270,161 @@ static void ir_builder_split_vectors(ir_builder *self) {
     }
 }
 
+/*
+ * Global layout
+ * Past `end_sys_globals`, whose layout is dictated by the engine, globals
+ * nothing refers to are left out and constants without a def share the
+ * slots of an earlier constant with the same contents, whatever its type.
+ * A float whose value only a later vector constant has brings that vector
+ * forward to use its component, and constants which are all zero use nil.
+ * The optimizations count the slots they saved.
+ */
+struct ir_global_layout {
+    typedef std::tuple<int, int, int> vector_words;
+
+    std::unordered_set<const ir_value*> pointees; /* targets of pointer constants */
+    std::unordered_map<int, int32_t>    words;    /* constant word -> address */
+    std::map<vector_words, int32_t>     vectors;  /* vector constant -> address */
+    std::unordered_map<int, size_t>     pending;  /* word -> first vector constant having it */
+    std::vector<bool>                   placed;   /* generated ahead of their turn */
+    std::vector<ir_value*>              zeros;    /* placed onto nil once it exists */
+};
+
+static bool ir_global_unreferenced(const ir_global_layout &layout, const ir_value *global)
+{
+    if (!OPTS_OPTIMIZATION(OPTIM_STRIP_GLOBALS))
+        return false;
+    /* erasable ones are left out by generateGlobal already */
+    if (global->m_flags & (IR_FLAG_INDEXED | IR_FLAG_INCLUDE_DEF | IR_FLAG_NOREF | IR_FLAG_ERASABLE | IR_FLAG_SPLIT_VECTOR))
+        return false;
+    if (!global->m_reads.empty() || !global->m_writes.empty() || layout.pointees.count(global))
+        return false;
+    for (size_t mem = 0; mem < 3; ++mem) {
+        const ir_value *m = global->m_members[mem];
+        if (m && (!m->m_reads.empty() || !m->m_writes.empty()))
+            return false;
+    }
+
+    switch (global->m_vtype) {
+    case TYPE_FLOAT:
+    case TYPE_ENTITY:
+    case TYPE_STRING:
+        /* so are unread constants */
+        return !global->m_hasvalue || global->m_cvq != CV_CONST;
+    case TYPE_VECTOR:
+        return true;
+    case TYPE_FUNCTION:
+        return !global->m_hasvalue;
+    default:
+        return false;
+    }
+}
+
+static bool ir_global_overlappable(const ir_global_layout &layout, const ir_value *global)
+{
+    if (!OPTS_OPTIMIZATION(OPTIM_OVERLAP_IMMEDIATES) ||
+        !OPTS_OPTIMIZATION(OPTIM_STRIP_CONSTANT_NAMES) ||
+        OPTS_OPTION_BOOL(OPTION_G))
+    {
+        return false;
+    }
+    /* only constants which get no def, see generateGlobal */
+    if (!global->m_hasvalue || global->m_cvq != CV_CONST ||
+        (global->m_flags & (IR_FLAG_INDEXED | IR_FLAG_INCLUDE_DEF | IR_FLAG_SPLIT_VECTOR)))
+    {
+        return false;
+    }
+    if (!global->m_writes.empty() || layout.pointees.count(global))
+        return false;
+    for (size_t mem = 0; mem < 3; ++mem) {
+        if (global->m_members[mem] && !global->m_members[mem]->m_writes.empty())
+            return false;
+    }
+    switch (global->m_vtype) {
+    case TYPE_FLOAT:
+    case TYPE_ENTITY:
+    case TYPE_STRING:
+        /* unread ones take no slot to begin with */
+        return !global->m_reads.empty();
+    case TYPE_VECTOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void ir_builder_remember_immediate(ir_builder *self, ir_global_layout *layout, ir_value *global)
+{
+    const std::vector<int> &globals = self->m_code->globals;
+    int32_t                 addr    = global->m_code.globaladdr;
+
+    for (size_t d = 0; d < type_sizeof_[global->m_vtype]; ++d)
+        layout->words.emplace(globals[addr+d], addr+d);
+    if (global->m_vtype == TYPE_VECTOR)
+        layout->vectors.emplace(ir_global_layout::vector_words(globals[addr], globals[addr+1], globals[addr+2]), addr);
+}
+
+static int ir_global_word(ir_builder *self, const ir_value *global)
+{
+    if (global->m_vtype == TYPE_STRING)
+        return code_genstring(self->m_code.get(), global->m_constval.vstring);
+    return global->m_constval.ivec[0];
+}
+
+/* the later vector constant to generate ahead of its turn for the constant to use */
+static size_t ir_builder_immediate_ahead(ir_builder *self, ir_global_layout *layout, size_t index)
+{
+    ir_value *global = self->m_globals[index].get();
+    int       word;
+
+    if (global->m_vtype == TYPE_VECTOR || !ir_global_overlappable(*layout, global))
+        return 0;
+    word = ir_global_word(self, global);
+    if (!word || layout->words.count(word))
+        return 0;
+    auto vec = layout->pending.find(word);
+    if (vec == layout->pending.end() || vec->second <= index || layout->placed[vec->second])
+        return 0;
+    return vec->second;
+}
+
+/* place the constant onto an earlier one with the same contents */
+static bool ir_builder_overlap_immediate(ir_builder *self, ir_global_layout *layout, size_t index)
+{
+    ir_value  *global = self->m_globals[index].get();
+    const int *iptr   = global->m_constval.ivec;
+    int        word;
+
+    if (!ir_global_overlappable(*layout, global))
+        return false;
+
+    if (global->m_vtype == TYPE_VECTOR) {
+        if (!iptr[0] && !iptr[1] && !iptr[2]) {
+            layout->zeros.push_back(global);
+            return true;
+        }
+        auto it = layout->vectors.find(ir_global_layout::vector_words(iptr[0], iptr[1], iptr[2]));
+        if (it == layout->vectors.end())
+            return false;
+        global->setCodeAddress(it->second);
+        opts_optimizationcount[OPTIM_OVERLAP_IMMEDIATES] += 3;
+        return true;
+    }
+
+    word = ir_global_word(self, global);
+    if (!word) {
+        layout->zeros.push_back(global);
+        return true;
+    }
+
+    auto it = layout->words.find(word);
+    if (it == layout->words.end())
+        return false;
+    global->setCodeAddress(it->second);
+    ++opts_optimizationcount[OPTIM_OVERLAP_IMMEDIATES];
+    return true;
+}
+
 bool ir_builder::generate(const char *filename)
 {
     prog_section_statement_t stmt;
@@ -3671,28 +6436,79 @@ bool ir_builder::generate(const char *filename)
             ir_builder_split_vectors(this);
     }
 
-    for (auto& fp : m_fields)
-        ir_builder_prepare_field(m_code.get(), fp.get());
+    std::vector<bool> unused_fields;
+    ir_builder_layout_fields(this, unused_fields);
 
-    for (auto& gp : m_globals) {
-        ir_value *global = gp.get();
+    ir_global_layout layout;
+    size_t           sys_globals = 0;
+    size_t           unshared_temps = 0;
+    bool             overlap_locals = !OPTS_OPTION_BOOL(OPTION_G) && OPTS_OPTIMIZATION(OPTIM_OVERLAP_LOCALS);
+
+    for (size_t i = 0; i < m_globals.size(); ++i) {
+        ir_value *global = m_globals[i].get();
+        if (global->m_vtype == TYPE_POINTER && global->m_hasvalue)
+            layout.pointees.insert(global->m_constval.vpointer);
+        if (global->m_vtype == TYPE_VOID && global->m_name == "end_sys_globals")
+            sys_globals = i + 1;
+    }
+    for (size_t i = sys_globals; i < m_globals.size(); ++i) {
+        ir_value *global = m_globals[i].get();
+        if (global->m_vtype != TYPE_VECTOR || !ir_global_overlappable(layout, global) ||
+            ir_global_unreferenced(layout, global))
+        {
+            continue;
+        }
+        for (size_t d = 0; d < 3; ++d)
+            layout.pending.emplace(global->m_constval.ivec[d], i);
+    }
+    layout.placed.resize(m_globals.size());
+
+    for (size_t i = 0; i < m_globals.size(); ++i) {
+        ir_value *global = m_globals[i].get();
+        size_t    slots  = m_code->globals.size();
+
+        if (i >= sys_globals) {
+            if (ir_global_unreferenced(layout, global)) {
+                opts_optimizationcount[OPTIM_STRIP_GLOBALS] += type_sizeof_[global->m_vtype];
+                continue;
+            }
+            if (layout.placed[i])
+                continue;
+            size_t ahead = ir_builder_immediate_ahead(this, &layout, i);
+            if (ahead) {
+                if (!generateGlobal(m_globals[ahead].get(), false))
+                    return false;
+                ir_builder_remember_immediate(this, &layout, m_globals[ahead].get());
+                layout.placed[ahead] = true;
+            }
+            if (ir_builder_overlap_immediate(this, &layout, i))
+                continue;
+        }
         if (!generateGlobal(global, false)) {
             return false;
         }
+        if (i >= sys_globals && ir_global_overlappable(layout, global) &&
+            m_code->globals.size() - slots == type_sizeof_[global->m_vtype])
+        {
+            ir_builder_remember_immediate(this, &layout, global);
+        }
         if (global->m_vtype == TYPE_FUNCTION) {
             ir_function *func = global->m_constval.vfunc;
-            if (func && m_max_locals < func->m_allocated_locals &&
+            if (func && overlap_locals && m_max_locals < func->m_allocated_locals &&
                 !(func->m_flags & IR_FLAG_MASK_NO_OVERLAP))
             {
                 m_max_locals = func->m_allocated_locals;
             }
             if (func && m_max_globaltemps < func->m_globaltemps)
                 m_max_globaltemps = func->m_globaltemps;
+            if (func && unshared_temps < std::max(func->m_unshared_temps, func->m_globaltemps))
+                unshared_temps = std::max(func->m_unshared_temps, func->m_globaltemps);
         }
     }
+    opts_optimizationcount[OPTIM_OVERLAP_TEMPS] += unshared_temps - m_max_globaltemps;
 
-    for (auto& fp : m_fields) {
-        if (!ir_builder_gen_field(this, fp.get()))
+    for (size_t i = 0; i < m_fields.size(); ++i) {
+        if (!unused_fields[i] && !ir_builder_gen_field(this, m_fields[i].get()))
             return false;
     }
 
@@ -3701,6 +6517,10 @@ bool ir_builder::generate(const char *filename)
     m_code->globals.push_back(0);
     m_code->globals.push_back(0);
     m_code->globals.push_back(0);
+    for (auto &it : layout.zeros) {
+        it->setCodeAddress(m_nil->m_code.globaladdr);
+        opts_optimizationcount[OPTIM_OVERLAP_IMMEDIATES] += type_sizeof_[it->m_vtype];
+    }
 
     // generate virtual-instruction temps
     for (size_t i = 0; i < IR_MAX_VINSTR_TEMPS; ++i) {
@@ -3717,7 +6537,7 @@ bool ir_builder::generate(const char *filename)
     //for (size_t i = 0; i < m_max_globaltemps; ++i) {
     //    m_code->globals.push_back(0);
     //}
-    // generate common locals
+    // generate common locals, only functions overlapping their locals use them
     m_first_common_local = m_code->globals.size();
     m_code->globals.insert(m_code->globals.end(), m_max_locals, 0);
     // FIXME:DELME:
@@ -3778,6 +6598,11 @@ bool ir_builder::generate(const char *filename)
         memcpy(vec_add(lnofile, 5), ".lno", 5);
     }
 
+    if (OPTS_OPTION_STR(OPTION_EMIT_C) && !generateC(OPTS_OPTION_STR(OPTION_EMIT_C))) {
+        vec_free(lnofile);
+        return false;
+    }
+
     if (!code_write(m_code.get(), filename, lnofile)) {
         vec_free(lnofile);
         return false;
@@ -3787,6 +6612,434 @@ bool ir_builder::generate(const char *filename)
     return true;
 }
 
+/***********************************************************************
+ * C output
+ *
+ * Every function with a body becomes one C function working on the
+ * globals and entities of the VM hosting it, see qcrt.h.  It is emitted
+ * from the finished statements of the function so it behaves exactly
+ * like the VM executing them.  Like the VM, a function saves its locals
+ * on entry, copies its parameters into them and restores them on return.
+ */
+
+struct ir_c_function {
+    qcint_t  index;
+    size_t   first;
+    size_t   last;
+    uint32_t firstlocal;
+    uint32_t locals;
+};
+
+static bool ir_c_uses_pointer(const prog_section_statement_t &st) {
+    return (st.opcode >= INSTR_LOAD_F   && st.opcode <= INSTR_LOAD_FNC)   ||
+           (st.opcode >= INSTR_STOREP_F && st.opcode <= INSTR_STOREP_FNC) ||
+           (st.opcode >= INSTR_LOADA_F  && st.opcode <= INSTR_STOREA_V);
+}
+
+static void ir_c_jump(FILE *fp, const ir_c_function &fun, size_t target) {
+    if (target >= fun.first && target < fun.last)
+        fprintf(fp, "goto s%u;", (unsigned int)target);
+    else
+        fprintf(fp, "{ rt->error(rt, \"jump out of the function\"); return 1; }");
+}
+
+static void ir_c_statement(FILE *fp, const ir_c_function &fun, size_t i,
+                           const prog_section_statement_t &st,
+                           const std::vector<qcint_t> &direct)
+{
+    unsigned int a = st.o1.u1, b = st.o2.u1, c = st.o3.u1;
+    unsigned int globals = direct.size(); /* it has an entry for each global */
+    bool direct_call;
+    int j;
+
+    fprintf(fp, "    ");
+    switch (st.opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, "QCRT_I(%u) = QCRT_I(%u); ", OFS_RETURN + j, a + j);
+            fprintf(fp, "goto leave;");
+            break;
+
+        case INSTR_MUL_F:
+            fprintf(fp, "QCRT_F(%u) = QCRT_F(%u) * QCRT_F(%u);", c, a, b);
+            break;
+        case INSTR_MUL_V:
+            fprintf(fp, "QCRT_F(%u) = QCRT_V(%u,0) * QCRT_V(%u,0) + QCRT_V(%u,1) * QCRT_V(%u,1) + QCRT_V(%u,2) * QCRT_V(%u,2);",
+                    c, a, b, a, b, a, b);
+            break;
+        case INSTR_MUL_FV:
+        case INSTR_MUL_VF:
+            if (st.opcode == INSTR_MUL_VF)
+                std::swap(a, b);
+            fprintf(fp, "{ qcrt_float_t f = QCRT_F(%u);", a);
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " QCRT_V(%u,%d) = f * QCRT_V(%u,%d);", c, j, b, j);
+            fprintf(fp, " }");
+            break;
+        case INSTR_DIV_F:
+            fprintf(fp, "QCRT_F(%u) = QCRT_F(%u) != 0.0f ? QCRT_F(%u) / QCRT_F(%u) : 0;", c, b, a, b);
+            break;
+        case INSTR_ADD_F:
+            fprintf(fp, "QCRT_F(%u) = QCRT_F(%u) + QCRT_F(%u);", c, a, b);
+            break;
+        case INSTR_SUB_F:
+            fprintf(fp, "QCRT_F(%u) = QCRT_F(%u) - QCRT_F(%u);", c, a, b);
+            break;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, "QCRT_V(%u,%d) = QCRT_V(%u,%d) %c QCRT_V(%u,%d); ",
+                        c, j, a, j, st.opcode == INSTR_ADD_V ? '+' : '-', b, j);
+            break;
+
+        case INSTR_EQ_F:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) == QCRT_F(%u));", c, a, b);
+            break;
+        case INSTR_NE_F:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) != QCRT_F(%u));", c, a, b);
+            break;
+        case INSTR_EQ_V:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_V(%u,0) == QCRT_V(%u,0) && QCRT_V(%u,1) == QCRT_V(%u,1) && QCRT_V(%u,2) == QCRT_V(%u,2));",
+                    c, a, b, a, b, a, b);
+            break;
+        case INSTR_NE_V:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_V(%u,0) != QCRT_V(%u,0) || QCRT_V(%u,1) != QCRT_V(%u,1) || QCRT_V(%u,2) != QCRT_V(%u,2));",
+                    c, a, b, a, b, a, b);
+            break;
+        case INSTR_EQ_S:
+            fprintf(fp, "QCRT_F(%u) = qcrt_streq(rt, QCRT_I(%u), QCRT_I(%u));", c, a, b);
+            break;
+        case INSTR_NE_S:
+            fprintf(fp, "QCRT_F(%u) = !qcrt_streq(rt, QCRT_I(%u), QCRT_I(%u));", c, a, b);
+            break;
+        case INSTR_EQ_E:
+        case INSTR_EQ_FNC:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_I(%u) == QCRT_I(%u));", c, a, b);
+            break;
+        case INSTR_NE_E:
+        case INSTR_NE_FNC:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_I(%u) != QCRT_I(%u));", c, a, b);
+            break;
+        case INSTR_LE:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) <= QCRT_F(%u));", c, a, b);
+            break;
+        case INSTR_GE:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) >= QCRT_F(%u));", c, a, b);
+            break;
+        case INSTR_LT:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) < QCRT_F(%u));", c, a, b);
+            break;
+        case INSTR_GT:
+            fprintf(fp, "QCRT_F(%u) = (QCRT_F(%u) > QCRT_F(%u));", c, a, b);
+            break;
+
+        case INSTR_LOAD_F:
+        case INSTR_LOAD_S:
+        case INSTR_LOAD_ENT:
+        case INSTR_LOAD_FLD:
+        case INSTR_LOAD_FNC:
+            fprintf(fp, "if (!(p = qcrt_field(rt, QCRT_I(%u), QCRT_I(%u), 1))) return 1;\n    QCRT_I(%u) = p[0];", a, b, c);
+            break;
+        case INSTR_LOAD_V:
+            fprintf(fp, "if (!(p = qcrt_field(rt, QCRT_I(%u), QCRT_I(%u), 3))) return 1;", a, b);
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, "\n    QCRT_I(%u) = p[%d];", c + j, j);
+            break;
+        case INSTR_ADDRESS:
+            fprintf(fp, "if (!qcrt_field(rt, QCRT_I(%u), QCRT_I(%u), 1)) return 1;\n    QCRT_I(%u) = QCRT_I(%u) * rt->entityfields + QCRT_I(%u);",
+                    a, b, c, a, b);
+            break;
+
+        case INSTR_STORE_F:
+        case INSTR_STORE_S:
+        case INSTR_STORE_ENT:
+        case INSTR_STORE_FLD:
+        case INSTR_STORE_FNC:
+            fprintf(fp, "QCRT_I(%u) = QCRT_I(%u);", b, a);
+            break;
+        case INSTR_STORE_V:
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, "QCRT_I(%u) = QCRT_I(%u); ", b + j, a + j);
+            break;
+        case INSTR_STOREP_F:
+        case INSTR_STOREP_S:
+        case INSTR_STOREP_ENT:
+        case INSTR_STOREP_FLD:
+        case INSTR_STOREP_FNC:
+            fprintf(fp, "if (!(p = qcrt_pointer(rt, QCRT_I(%u), 1))) return 1;\n    p[0] = QCRT_I(%u);", b, a);
+            break;
+        case INSTR_STOREP_V:
+            fprintf(fp, "if (!(p = qcrt_pointer(rt, QCRT_I(%u), 3))) return 1;", b);
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, "\n    p[%d] = QCRT_I(%u);", j, a + j);
+            break;
+
+        case INSTR_NOT_F:
+            fprintf(fp, "QCRT_F(%u) = !QCRT_TRUE(%u);", c, a);
+            break;
+        case INSTR_NOT_V:
+            fprintf(fp, "QCRT_F(%u) = !QCRT_V(%u,0) && !QCRT_V(%u,1) && !QCRT_V(%u,2);", c, a, a, a);
+            break;
+        case INSTR_NOT_S:
+            fprintf(fp, "QCRT_F(%u) = !QCRT_I(%u) || !*rt->string(rt, QCRT_I(%u));", c, a, a);
+            break;
+        case INSTR_NOT_ENT:
+        case INSTR_NOT_FNC:
+            fprintf(fp, "QCRT_F(%u) = !QCRT_I(%u);", c, a);
+            break;
+
+        case INSTR_IF:
+        case INSTR_IFNOT:
+            fprintf(fp, "if (%sQCRT_TRUE(%u)) ", st.opcode == INSTR_IFNOT ? "!" : "", a);
+            ir_c_jump(fp, fun, i + st.o2.s1);
+            break;
+        case INSTR_GOTO:
+            ir_c_jump(fp, fun, i + st.o1.s1);
+            break;
+
+        case INSTR_CALL0:
+        case INSTR_CALL1:
+        case INSTR_CALL2:
+        case INSTR_CALL3:
+        case INSTR_CALL4:
+        case INSTR_CALL5:
+        case INSTR_CALL6:
+        case INSTR_CALL7:
+        case INSTR_CALL8:
+            /* constant functions with a body are called directly */
+            if (a < direct.size() && direct[a])
+                fprintf(fp, "if (qcf_%i(rt)) return 1;", (int)direct[a]);
+            else
+                fprintf(fp, "if (rt->call(rt, QCRT_I(%u), %d)) return 1;", a, st.opcode - INSTR_CALL0);
+            break;
+        case INSTR_TAILCALL:
+            /* like the VM, restore the locals before the callee runs */
+            direct_call = a < direct.size() && direct[a];
+            fprintf(fp, "{ ");
+            if (!direct_call)
+                fprintf(fp, "qcrt_int_t f = QCRT_I(%u); ", a);
+            if (fun.locals)
+                fprintf(fp, "memcpy(g + %u, saved, sizeof(saved)); ", (unsigned int)fun.firstlocal);
+            if (direct_call)
+                fprintf(fp, "return qcf_%i(rt); }", (int)direct[a]);
+            else
+                fprintf(fp, "return rt->call(rt, f, %u); }", b);
+            break;
+
+        case INSTR_STATE:
+            fprintf(fp, "if (rt->state(rt, QCRT_F(%u), QCRT_I(%u))) return 1;", a, b);
+            break;
+
+        case INSTR_AND:
+            fprintf(fp, "QCRT_F(%u) = QCRT_TRUE(%u) && QCRT_TRUE(%u);", c, a, b);
+            break;
+        case INSTR_OR:
+            fprintf(fp, "QCRT_F(%u) = QCRT_TRUE(%u) || QCRT_TRUE(%u);", c, a, b);
+            break;
+        case INSTR_BITAND:
+            fprintf(fp, "QCRT_F(%u) = (int)QCRT_F(%u) & (int)QCRT_F(%u);", c, a, b);
+            break;
+        case INSTR_BITOR:
+            fprintf(fp, "QCRT_F(%u) = (int)QCRT_F(%u) | (int)QCRT_F(%u);", c, a, b);
+            break;
+
+        /* like the VM, the extended instructions read their operands first */
+        case INSTR_BITXOR:
+            fprintf(fp, "QCRT_F(%u) = (int)QCRT_F(%u) ^ (int)QCRT_F(%u);", c, a, b);
+            break;
+        case INSTR_BITAND_V:
+        case INSTR_BITAND_VF:
+        case INSTR_BITOR_V:
+        case INSTR_BITOR_VF:
+        case INSTR_BITXOR_V:
+        case INSTR_BITXOR_VF:
+        {
+            bool scalar = st.opcode == INSTR_BITAND_VF ||
+                          st.opcode == INSTR_BITOR_VF  ||
+                          st.opcode == INSTR_BITXOR_VF;
+            char op = (st.opcode == INSTR_BITAND_V || st.opcode == INSTR_BITAND_VF) ? '&' :
+                      (st.opcode == INSTR_BITOR_V  || st.opcode == INSTR_BITOR_VF)  ? '|' : '^';
+            fprintf(fp, "{ int x[3], y[3];");
+            for (j = 0; j < 3; ++j) {
+                if (scalar)
+                    fprintf(fp, " x[%d] = (int)QCRT_V(%u,%d); y[%d] = (int)QCRT_F(%u);", j, a, j, j, b);
+                else
+                    fprintf(fp, " x[%d] = (int)QCRT_V(%u,%d); y[%d] = (int)QCRT_V(%u,%d);", j, a, j, j, b, j);
+            }
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " QCRT_V(%u,%d) = x[%d] %c y[%d];", c, j, j, op, j);
+            fprintf(fp, " }");
+            break;
+        }
+        case INSTR_CROSS:
+            fprintf(fp, "{ qcrt_float_t x[3], y[3];");
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " x[%d] = QCRT_V(%u,%d); y[%d] = QCRT_V(%u,%d);", j, a, j, j, b, j);
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " QCRT_V(%u,%d) = x[%d] * y[%d] - x[%d] * y[%d];",
+                        c, j, (j + 1) % 3, (j + 2) % 3, (j + 2) % 3, (j + 1) % 3);
+            fprintf(fp, " }");
+            break;
+
+        case INSTR_LOADA_F:
+            fprintf(fp, "if (!(p = qcrt_index(rt, %u, QCRT_F(%u), 1, %u))) return 1;\n    QCRT_I(%u) = p[0];",
+                    a, b, globals, c);
+            break;
+        case INSTR_LOADA_V:
+            fprintf(fp, "if (!(p = qcrt_index(rt, %u, QCRT_F(%u), 3, %u))) return 1;\n", a, b, globals);
+            fprintf(fp, "    { qcrt_int_t v[3] = { p[0], p[1], p[2] };");
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " QCRT_I(%u) = v[%d];", c + j, j);
+            fprintf(fp, " }");
+            break;
+        case INSTR_STOREA_F:
+            fprintf(fp, "if (!(p = qcrt_index(rt, %u, QCRT_F(%u), 1, %u))) return 1;\n    p[0] = QCRT_I(%u);",
+                    b, c, globals, a);
+            break;
+        case INSTR_STOREA_V:
+            fprintf(fp, "if (!(p = qcrt_index(rt, %u, QCRT_F(%u), 3, %u))) return 1;\n", b, c, globals);
+            fprintf(fp, "    { qcrt_int_t v[3] = { QCRT_I(%u), QCRT_I(%u), QCRT_I(%u) };", a, a + 1, a + 2);
+            for (j = 0; j < 3; ++j)
+                fprintf(fp, " p[%d] = v[%d];", j, j);
+            fprintf(fp, " }");
+            break;
+
+        default:
+            fprintf(fp, "rt->error(rt, \"illegal instruction\"); return 1;");
+            break;
+    }
+    fprintf(fp, "\n");
+}
+
+bool ir_builder::generateC(const char *filename)
+{
+    code_t *code = m_code.get();
+    std::vector<ir_c_function> functions;
+    std::vector<qcint_t>       direct(code->globals.size(), 0);
+    std::vector<bool>          labels(code->statements.size() + 1, false);
+    uint16_t crc;
+    FILE    *fp;
+    size_t   i;
+
+    for (i = 1; i < code->functions.size(); ++i) {
+        if (code->functions[i].entry >= 0)
+            functions.push_back({ (qcint_t)i, (size_t)code->functions[i].entry, 0,
+                                  code->functions[i].firstlocal, code->functions[i].locals });
+    }
+    std::sort(functions.begin(), functions.end(),
+        [](const ir_c_function &a, const ir_c_function &b) { return a.first < b.first; });
+    for (i = 0; i < functions.size(); ++i)
+        functions[i].last = i+1 < functions.size() ? functions[i+1].first : code->statements.size();
+
+    for (auto& gp : m_globals) {
+        ir_value *global = gp.get();
+        if (global->m_vtype != TYPE_FUNCTION || !global->m_hasvalue || !global->m_constval.vfunc ||
+            (global->m_cvq != CV_CONST && !global->m_writes.empty()))
+            continue;
+        if (global->m_constval.vfunc->m_code_function_def > 0)
+            direct[global->m_code.globaladdr] = global->m_constval.vfunc->m_code_function_def;
+    }
+
+    for (i = 0; i < code->statements.size(); ++i) {
+        const prog_section_statement_t &st = code->statements[i];
+        if (st.opcode == INSTR_IF || st.opcode == INSTR_IFNOT)
+            labels[std::min(i + st.o2.s1, code->statements.size())] = true;
+        else if (st.opcode == INSTR_GOTO)
+            labels[std::min(i + st.o1.s1, code->statements.size())] = true;
+    }
+
+    if (!(fp = fopen(filename, "w"))) {
+        con_err("failed to open `%s` for writing\n", filename);
+        return false;
+    }
+    if (!OPTS_OPTION_BOOL(OPTION_QUIET))
+        con_out("writing '%s'\n", filename);
+
+    fprintf(fp, "/* generated by gmqcc, do not edit */\n#include \"qcrt.h\"\n\n");
+    for (auto &it : functions)
+        fprintf(fp, "static int qcf_%i(qcrt_t *rt);\n", (int)it.index);
+
+    for (auto &it : functions) {
+        const prog_section_function_t &def = code->functions[it.index];
+        bool pointers = false;
+        bool returns  = false;
+        size_t pos = def.firstlocal;
+        int p;
+
+        for (i = it.first; i < it.last; ++i) {
+            pointers = pointers || ir_c_uses_pointer(code->statements[i]);
+            returns  = returns  || code->statements[i].opcode == INSTR_DONE
+                                || code->statements[i].opcode == INSTR_RETURN;
+        }
+
+        fprintf(fp, "\n/* %s */\nstatic int qcf_%i(qcrt_t *rt)\n{\n", &code->chars[def.name], (int)it.index);
+        fprintf(fp, "    qcrt_int_t *const g = rt->globals;\n");
+        if (pointers)
+            fprintf(fp, "    qcrt_int_t *p;\n");
+        if (def.locals) {
+            fprintf(fp, "    qcrt_int_t saved[%u];\n", (unsigned int)def.locals);
+            fprintf(fp, "    memcpy(saved, g + %u, sizeof(saved));\n", (unsigned int)def.firstlocal);
+        }
+        for (p = 0; p < def.nargs; ++p) {
+            fprintf(fp, "    memcpy(g + %u, g + %u, %u * sizeof(qcrt_int_t));\n",
+                    (unsigned int)pos, (unsigned int)(OFS_PARM0 + 3*p), (unsigned int)def.argsize[p]);
+            pos += def.argsize[p];
+        }
+
+        for (i = it.first; i < it.last; ++i) {
+            if (labels[i])
+                fprintf(fp, "s%u:\n", (unsigned int)i);
+            ir_c_statement(fp, it, i, code->statements[i], direct);
+        }
+        if (it.first == it.last || (code->statements[it.last-1].opcode != INSTR_DONE     &&
+                                    code->statements[it.last-1].opcode != INSTR_RETURN   &&
+                                    code->statements[it.last-1].opcode != INSTR_TAILCALL &&
+                                    code->statements[it.last-1].opcode != INSTR_GOTO))
+            fprintf(fp, "    rt->error(rt, \"execution left the function\");\n    return 1;\n");
+        if (returns) {
+            fprintf(fp, "leave:\n");
+            if (def.locals)
+                fprintf(fp, "    memcpy(g + %u, saved, sizeof(saved));\n", (unsigned int)def.firstlocal);
+            fprintf(fp, "    return 0;\n");
+        }
+        fprintf(fp, "}\n");
+    }
+
+    if (OPTS_OPTION_BOOL(OPTION_FORCECRC))
+        crc = OPTS_OPTION_U16(OPTION_FORCED_CRC);
+    else
+        crc = code->crc;
+
+    if (!functions.empty()) {
+        fprintf(fp, "\nstatic const qcrt_entry_t qcrt_entries[] = {\n");
+        for (auto &it : functions)
+            fprintf(fp, "    { %i, qcf_%i },\n", (int)it.index, (int)it.index);
+        fprintf(fp, "};\n");
+    }
+    fprintf(fp, "\nconst qcrt_module_t *qcrt_module(void) {\n"
+                "    static const qcrt_module_t module = {\n"
+                "        QCRT_VERSION, %u, %u, %u, %u,\n"
+                "        %s, %u\n"
+                "    };\n"
+                "    return &module;\n"
+                "}\n",
+                (unsigned int)crc,
+                (unsigned int)code->globals.size(),
+                (unsigned int)code->functions.size(),
+                (unsigned int)code->statements.size(),
+                functions.empty() ? "NULL" : "qcrt_entries",
+                (unsigned int)functions.size());
+
+    if (ferror(fp)) {
+        fclose(fp);
+        con_err("failed to write `%s`\n", filename);
+        return false;
+    }
+    fclose(fp);
+    return true;
+}
+
 /***********************************************************************
  *IR DEBUG Dump functions...
  */
@@ -3932,7 +7185,7 @@ void ir_function_dump(ir_function *f, char *ind,
     }
     if (f->m_blocks.size())
     {
-        oprintf("%slife passes: %i\n", ind, (int)f->m_run_id);
+        oprintf("%slife propagations: %i\n", ind, (int)f->m_run_id);
         for (i = 0; i < f->m_blocks.size(); ++i) {
             ir_block_dump(f->m_blocks[i].get(), ind, oprintf);
         }
@@ -6,7 +6,7 @@
  * Type large enough to hold all the possible IR flags. This should be
  * changed if the static assertion at the end of this file fails.
  */
-typedef uint8_t ir_flag_t;
+typedef uint16_t ir_flag_t;
 
 struct ir_value;
 struct ir_instr;
@@ -20,6 +20,185 @@ struct ir_life_entry_t {
     size_t end;
 };
 
+/*
+ * Set of the values a function computes life ranges for, indexed by
+ * ir_value::m_life_index.
+ */
+struct ir_bitset {
+    void resize(size_t bits) { m_words.assign((bits + 63) / 64, 0); }
+    void clear() { std::fill(m_words.begin(), m_words.end(), 0); }
+
+    bool test(size_t bit) const { return (m_words[bit / 64] >> (bit % 64)) & 1; }
+    void set(size_t bit) { m_words[bit / 64] |= (uint64_t)1 << (bit % 64); }
+    void reset(size_t bit) { m_words[bit / 64] &= ~((uint64_t)1 << (bit % 64)); }
+
+    void merge(const ir_bitset &other) {
+        for (size_t i = 0; i < m_words.size(); ++i)
+            m_words[i] |= other.m_words[i];
+    }
+
+    void intersect(const ir_bitset &other) {
+        for (size_t i = 0; i < m_words.size(); ++i)
+            m_words[i] &= other.m_words[i];
+    }
+
+    /* calls fn with the index of every bit set, in ascending order */
+    template<typename F>
+    void each(F fn) const {
+        for (size_t i = 0; i < m_words.size(); ++i) {
+            for (uint64_t w = m_words[i]; w; w &= w - 1) {
+#if defined(__GNUC__) /* clang defines it as well */
+                size_t bit = __builtin_ctzll(w);
+#else
+                size_t bit = 0;
+                while (!((w >> bit) & 1))
+                    ++bit;
+#endif
+                fn(i * 64 + bit);
+            }
+        }
+    }
+
+    std::vector<uint64_t> m_words;
+};
+
+#define IR_ARENA_CHUNK    65536
+#define IR_ARENA_MAX_SIZE 512 /* larger objects are not reused */
+
+/*
+ * Hands out the memory of the values, instructions and blocks from large
+ * chunks instead of allocating them one by one, and keeps deleted ones
+ * for the next object of the same size. Every thread working on the IR
+ * allocates from and frees into its own arena, the builder owns them all
+ * and their chunks are only freed along with it.
+ */
+struct ir_arena {
+    ir_arena() = default;
+    ir_arena(const ir_arena&) = delete;
+    ir_arena &operator=(const ir_arena&) = delete;
+    ~ir_arena();
+
+    void *allocate(size_t bytes);
+    void release(void *ptr, size_t bytes);
+
+    static thread_local ir_arena *current;
+
+private:
+    struct slot { slot *next; };
+
+    std::vector<void*> m_chunks;
+    char *m_top = nullptr;
+    char *m_end = nullptr;
+    slot *m_free[IR_ARENA_MAX_SIZE / sizeof(void*)] = {};
+};
+
+/* Makes new/delete of the deriving class use the thread's ir_arena. */
+struct ir_arena_object {
+    void *operator new(size_t bytes) { return ir_arena::current->allocate(bytes); }
+    void operator delete(void *ptr, size_t bytes) { ir_arena::current->release(ptr, bytes); }
+};
+
+/*
+ * A vector of trivially copyable elements keeping the first N of them
+ * inside of itself. Most values are only read and written once or twice,
+ * most blocks have one or two entries and exits and calls take few
+ * parameters, so these rarely need to allocate.
+ */
+template<typename T, size_t N>
+struct ir_small_vector {
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    ir_small_vector() = default;
+    ir_small_vector(const ir_small_vector &other) { *this = other; }
+    ~ir_small_vector() {
+        if (m_capacity > N)
+            mem_d(m_heap);
+    }
+
+    ir_small_vector &operator=(const ir_small_vector &other) {
+        if (this == &other)
+            return *this;
+        m_size = 0;
+        reserve(other.m_size);
+        memcpy(data(), other.data(), other.m_size * sizeof(T));
+        m_size = other.m_size;
+        return *this;
+    }
+
+    T *data() { return m_capacity > N ? m_heap : m_inline; }
+    const T *data() const { return m_capacity > N ? m_heap : m_inline; }
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + m_size; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + m_size; }
+
+    T &operator[](size_t i) { return data()[i]; }
+    const T &operator[](size_t i) const { return data()[i]; }
+    T &front() { return data()[0]; }
+    T &back() { return data()[m_size - 1]; }
+    const T &front() const { return data()[0]; }
+    const T &back() const { return data()[m_size - 1]; }
+
+    void clear() { m_size = 0; }
+    void pop_back() { --m_size; }
+
+    void push_back(T value) {
+        if (m_size == m_capacity)
+            reserve(m_size * 2);
+        data()[m_size++] = value;
+    }
+    void emplace_back(T value) { push_back(value); }
+
+    iterator insert(iterator pos, const T &value) {
+        return insert(pos, &value, &value + 1);
+    }
+
+    /* the inserted range must not be part of this vector */
+    iterator insert(iterator pos, const T *first, const T *last) {
+        size_t at    = pos - begin();
+        size_t count = last - first;
+        reserve(m_size + count);
+        T *p = data() + at;
+        memmove(p + count, p, (m_size - at) * sizeof(T));
+        memcpy(p, first, count * sizeof(T));
+        m_size += count;
+        return p;
+    }
+
+    iterator erase(iterator pos) { return erase(pos, pos + 1); }
+    iterator erase(iterator first, iterator last) {
+        memmove(first, last, (end() - last) * sizeof(T));
+        m_size -= last - first;
+        return first;
+    }
+
+    void reserve(size_t count) {
+        if (count <= m_capacity)
+            return;
+        T *heap = (T*)mem_a(count * sizeof(T));
+        memcpy(heap, data(), m_size * sizeof(T));
+        if (m_capacity > N)
+            mem_d(m_heap);
+        m_heap = heap;
+        m_capacity = count;
+    }
+
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "ir_small_vector elements are copied with memcpy");
+
+    uint32_t m_size = 0;
+    uint32_t m_capacity = N;
+    union {
+        T *m_heap;
+        T m_inline[N];
+    };
+};
+
 enum {
     IR_FLAG_HAS_ARRAYS              = 1 << 0,
     IR_FLAG_HAS_UNINITIALIZED       = 1 << 1,
@@ -29,13 +208,15 @@ enum {
     IR_FLAG_BLOCK_COVERAGE          = 1 << 5,
     IR_FLAG_NOREF                   = 1 << 6,
     IR_FLAG_SPLIT_VECTOR            = 1 << 7,
+    IR_FLAG_INLINED                 = 1 << 8,
+    IR_FLAG_INDEXED                 = 1 << 9, /* element of an array indexed by LOADA/STOREA */
 
     IR_FLAG_LAST,
     IR_FLAG_MASK_NO_OVERLAP      = (IR_FLAG_HAS_ARRAYS | IR_FLAG_HAS_UNINITIALIZED),
     IR_FLAG_MASK_NO_LOCAL_TEMPS  = (IR_FLAG_HAS_ARRAYS | IR_FLAG_HAS_UNINITIALIZED)
 };
 
-struct ir_value {
+struct ir_value : ir_arena_object {
     ir_value(std::string&& name, store_type storetype, qc_type vtype);
     ir_value(ir_function *owner, std::string&& name, store_type storetype, qc_type vtype);
     ~ir_value();
@@ -71,8 +252,8 @@ struct ir_value {
     int m_cvq;       // 'const' vs 'var' qualifier
     ir_flag_t m_flags;
 
-    std::vector<ir_instr *> m_reads;
-    std::vector<ir_instr *> m_writes;
+    ir_small_vector<ir_instr *, 2> m_reads;
+    ir_small_vector<ir_instr *, 2> m_writes;
 
     // constant values
     bool m_hasvalue;
@@ -99,10 +280,11 @@ struct ir_value {
     ir_value *m_memberof;
 
     bool m_unique_life;      // arrays will never overlap with temps
+    size_t m_life_index;     // bit in the living sets of the function being analysed
     bool m_locked;           // temps living during a CALL must be locked
     bool m_callparam;
 
-    std::vector<ir_life_entry_t> m_life; // For the temp allocator
+    ir_small_vector<ir_life_entry_t, 1> m_life; // For the temp allocator
 
     size_t size() const;
 
@@ -116,7 +298,7 @@ struct ir_phi_entry_t {
 };
 
 /* instruction */
-struct ir_instr {
+struct ir_instr : ir_arena_object {
     ir_instr(lex_ctx_t, ir_block *owner, int opcode);
     ~ir_instr();
 
@@ -125,8 +307,8 @@ struct ir_instr {
     ir_value *(_m_ops[3]) = { nullptr, nullptr, nullptr };
     ir_block *(m_bops[2]) = { nullptr, nullptr };
 
-    std::vector<ir_phi_entry_t> m_phi;
-    std::vector<ir_value *> m_params;
+    ir_small_vector<ir_phi_entry_t, 1> m_phi;
+    ir_small_vector<ir_value *, 2> m_params;
 
     // For the temp-allocation
     size_t m_eid = 0;
@@ -138,7 +320,7 @@ struct ir_instr {
 };
 
 /* block */
-struct ir_block {
+struct ir_block : ir_arena_object {
     ir_block(ir_function *owner, const std::string& name);
     ~ir_block();
 
@@ -149,9 +331,9 @@ struct ir_block {
     bool m_final = false; /* once a jump is added we're done */
 
     std::vector<ir_instr *> m_instr;
-    std::vector<ir_block *> m_entries;
-    std::vector<ir_block *> m_exits;
-    std::vector<ir_value *> m_living;
+    ir_small_vector<ir_block *, 2> m_entries;
+    ir_small_vector<ir_block *, 2> m_exits;
+    ir_bitset m_living;
 
     /* For the temp-allocation */
     size_t m_entry_id  = 0;
@@ -160,6 +342,7 @@ struct ir_block {
 
     bool m_generated = false;
     size_t m_code_start = 0;
+    bool m_cold = false; /* every path from here ends in a noreturn call */
 };
 
 ir_value*       ir_block_create_binop(ir_block*, lex_ctx_t, const char *label, int op, ir_value *left, ir_value *right);
@@ -168,6 +351,8 @@ bool GMQCC_WARN ir_block_create_store_op(ir_block*, lex_ctx_t, int op, ir_value
 bool GMQCC_WARN ir_block_create_storep(ir_block*, lex_ctx_t, ir_value *target, ir_value *what);
 ir_value*       ir_block_create_load_from_ent(ir_block*, lex_ctx_t, const char *label, ir_value *ent, ir_value *field, qc_type outype);
 ir_value*       ir_block_create_fieldaddress(ir_block*, lex_ctx_t, const char *label, ir_value *entity, ir_value *field);
+ir_value*       ir_block_create_load_from_array(ir_block*, lex_ctx_t, const char *label, ir_value *array, ir_value *index);
+bool GMQCC_WARN ir_block_create_store_to_array(ir_block*, lex_ctx_t, ir_value *array, ir_value *index, ir_value *what);
 bool GMQCC_WARN ir_block_create_state_op(ir_block*, lex_ctx_t, ir_value *frame, ir_value *think);
 
 /* This is to create an instruction of the form
@@ -206,6 +391,7 @@ struct ir_function {
     std::vector<int> m_params;
     ir_flag_t        m_flags   = 0;
     int              m_builtin = 0;
+    bool             m_finalized = false;
 
     std::vector<std::unique_ptr<ir_block>> m_blocks;
 
@@ -220,6 +406,7 @@ struct ir_function {
 
     size_t m_allocated_locals = 0;
     size_t m_globaltemps      = 0;
+    size_t m_unshared_temps   = 0; /* m_globaltemps without -Ooverlap-temps */
 
     ir_block*  m_first = nullptr;
     ir_block*  m_last  = nullptr;
@@ -237,13 +424,21 @@ struct ir_function {
 
     /* for temp allocation */
     size_t m_run_id = 0;
+    std::vector<ir_value *> m_life_values; /* by m_life_index */
 
     /* vararg support: */
     size_t m_max_varargs = 0;
+
+    /* conditional jumps into cold blocks, generated after the rest */
+    std::vector<std::pair<size_t, ir_block *>> m_cold_jumps;
+
+    /* immediates made by the optimizations, added to the globals once finalized */
+    std::vector<std::unique_ptr<ir_value>> m_literals;
 };
 
 
 ir_value*       ir_function_create_local(ir_function *self, const std::string& name, qc_type vtype, bool param);
+bool GMQCC_WARN ir_function_inline(ir_function*);
 bool GMQCC_WARN ir_function_finalize(ir_function*);
 ir_block*       ir_function_create_block(lex_ctx_t ctx, ir_function*, const char *label);
 
@@ -259,7 +454,10 @@ struct ir_builder {
     ir_value *createGlobal(const std::string &name, qc_type vtype);
     ir_value *createField(const std::string &name, qc_type vtype);
     ir_value *get_va_count();
+    void stripFunctions(std::vector<ir_function*> &functions);
+    bool finalize(const std::vector<ir_function*> &functions);
     bool generate(const char *filename);
+    bool generateC(const char *filename);
     void dump(int (*oprintf)(const char*, ...)) const;
 
     ir_value *generateExtparamProto();
@@ -267,6 +465,10 @@ struct ir_builder {
 
     ir_value *literalFloat(float value, bool add_to_list);
 
+    /* the main thread's arena and the ones of the threads finalizing the functions, freed last */
+    ir_arena                               m_arena;
+    std::vector<std::unique_ptr<ir_arena>> m_thread_arenas;
+
     std::string m_name;
     std::vector<std::unique_ptr<ir_function>> m_functions;
     std::vector<std::unique_ptr<ir_value>>    m_globals;
@@ -298,6 +500,7 @@ struct ir_builder {
     ir_value    *m_nil;
     ir_value    *m_reserved_va_count = nullptr;
     ir_value    *m_coverage_func = nullptr;
+    size_t       m_sys_fields = 0; /* the fields up to end_sys_fields */
 
     /* some virtual instructions require temps, and their code is isolated
      * so that we don't need to keep track of their liveness.
@@ -41,11 +41,15 @@ static int usage(void) {
             "  -s filename            add a progs.src file to be used\n");
     con_out("  -E                     stop after preprocessing\n");
     con_out("  -q, --quiet            be less verbose\n");
+    con_out("  -j jobs                threads optimizing functions, defaults to all\n");
     con_out("  -config file           use the specified ini file\n");
     con_out("  -std=standard          select one of the following standards\n"
             "       -std=qcc          original QuakeC\n"
             "       -std=fteqcc       fteqcc QuakeC\n"
             "       -std=gmqcc        this compiler (default)\n");
+    con_out("  -target=target        select the instructions to use\n"
+            "       -target=standard  the original instruction set (default)\n"
+            "       -target=gmqcc-ext also the extended instructions of qcvm\n");
     con_out("  -f<flag>               enable a flag\n"
             "  -fno-<flag>            disable a flag\n"
             "  -fhelp                 list possible flags\n");
@@ -62,6 +66,9 @@ static int usage(void) {
             "  -Ohelp                 list optimizations\n");
     con_out("  -force-crc=num         force a specific checksum into the header\n");
     con_out("  -state-fps=num         emulate OP_STATE with the specified FPS\n");
+    con_out("  -emit-c=file           also write the program as C source, see qcrt.h\n");
+    con_out("  -keep=name[,name...]   functions -Ostrip-functions must not remove\n");
+    con_out("  -fprofile-use=file     optimize for a profile written by qcvm -profile-out\n");
     con_out("  -coverage              add coverage support\n");
     return -1;
 }
@@ -185,6 +192,17 @@ static bool options_parse(int argc, char **argv) {
                 }
                 continue;
             }
+            if (options_long_gcc("target", &argc, &argv, &argarg)) {
+                if (!strcmp(argarg, "standard"))
+                    OPTS_OPTION_U32(OPTION_TARGET) = TARGET_STANDARD;
+                else if (!strcmp(argarg, "gmqcc-ext"))
+                    OPTS_OPTION_U32(OPTION_TARGET) = TARGET_GMQCC_EXT;
+                else {
+                    con_out("Unknown target: %s\n", argarg);
+                    return false;
+                }
+                continue;
+            }
             if (options_long_gcc("force-crc", &argc, &argv, &argarg)) {
 
                 OPTS_OPTION_BOOL(OPTION_FORCECRC)   = true;
@@ -204,6 +222,18 @@ static bool options_parse(int argc, char **argv) {
                 OPTS_OPTION_STR(OPTION_PROGSRC) = argarg;
                 continue;
             }
+            if (options_long_gcc("emit-c", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_EMIT_C) = argarg;
+                continue;
+            }
+            if (options_long_gcc("keep", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_KEEP) = argarg;
+                continue;
+            }
+            if (options_long_gcc("fprofile-use", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_PROFILE_USE) = argarg;
+                continue;
+            }
 
             /* show defaults (like pathscale) */
             if (!strcmp(argv[0]+1, "show-defaults")) {
@@ -424,6 +454,14 @@ static bool options_parse(int argc, char **argv) {
                     opts_output_wasset = true;
                     break;
 
+                case 'j':
+                    if (!options_witharg(&argc, &argv, &argarg)) {
+                        con_out("option -j requires an argument: the number of threads\n");
+                        return false;
+                    }
+                    OPTS_OPTION_U32(OPTION_JOBS) = strtol(argarg, nullptr, 0);
+                    break;
+
                 case 'a':
                 case 's':
                     item.type = argv[0][1] == 'a' ? TYPE_ASM : TYPE_SRC;
@@ -570,6 +608,11 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (OPTS_OPTION_STR(OPTION_PROFILE_USE) && !profile_load(OPTS_OPTION_STR(OPTION_PROFILE_USE))) {
+        retval = 1;
+        goto cleanup;
+    }
+
     if (OPTS_OPTION_BOOL(OPTION_DUMP)) {
         for (itr = 0; itr < COUNT_FLAGS; ++itr)
             con_out("Flag %s = %i\n",    opts_flag_list[itr].name, OPTS_FLAG(itr));
@@ -748,6 +791,7 @@ cleanup:
         mem_d((void*)operators);
 
     lex_cleanup();
+    profile_clear();
 
     if (!retval && compile_errors)
         retval = 1;
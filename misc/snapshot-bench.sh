@@ -0,0 +1,45 @@
+#!/bin/sh
+# Measures qcvm's snapshots against copying the whole state: a program
+# with 128 fields and 32768 globals spawns the given numbers of entities
+# and then dirties one global and one entity per frame.
+#
+#     misc/snapshot-bench.sh [frames] [entities...]
+prog=$0
+
+want() {
+	test -x "$1" && return
+	echo "$prog: missing $1"
+	echo "$prog: run this script from the top of a built gmqcc source tree"
+	exit 1
+}
+
+want ./gmqcc
+want ./qcvm
+
+frames=${1:-50}
+test $# -gt 0 && shift
+test $# -gt 0 || set -- 256 1024 4096 16384
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+for entities in "$@"; do
+	{
+		echo 'entity() spawn = #3;'
+		i=0; while [ $i -lt 128 ]; do echo ".float f$i;"; i=$((i+1)); done
+		# each float[] takes one more global for its element count
+		i=0; while [ $i -lt 32 ]; do echo "float g$i[1023];"; i=$((i+1)); done
+		echo 'float frame; entity first;'
+		echo 'void main() {'
+		echo '    float i; entity e;'
+		echo '    if (!first) {'
+		echo "        for (i = 0; i < $entities; ++i) { e = spawn(); if (!first) first = e; }"
+		echo '    }'
+		echo '    frame = frame + 1;'
+		echo '    g0[frame & 1023] = frame;'
+		echo '    first.f7 = frame;'
+		echo '}'
+	} > "$tmp/bench.qc"
+	./gmqcc -std=gmqcc -q -O2 -Wno-unused-variable "$tmp/bench.qc" -o "$tmp/bench.dat" || exit 1
+	./qcvm -v -rollback "$frames" "$tmp/bench.dat" || exit 1
+done
@@ -31,7 +31,7 @@ const opts_flag_def_t opts_flag_list[COUNT_FLAGS+1] = {
     { nullptr, LONGBIT(0) }
 };
 
-unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
+thread_local unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
 opts_cmd_t   opts; /* command line options */
 
 static void opts_setdefault(void) {
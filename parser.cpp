@@ -4395,6 +4395,9 @@ static bool parser_create_array_accessor(parser_t *parser, ast_value *array, con
         return false;
     }
     fval->m_flags &= ~(AST_FLAG_COVERAGE_MASK);
+    /* indexing global arrays directly often leaves them unused */
+    if (OPTS_OPTION_U32(OPTION_TARGET) == TARGET_GMQCC_EXT)
+        fval->m_flags |= AST_FLAG_ERASEABLE;
 
     func = ast_function::make(array->m_context, funcname, fval);
     if (!func) {
@@ -6236,8 +6239,11 @@ bool parser_finish(parser_t *parser, const char *output)
         return false;
     }
 
-    for (auto &it : parser->fields) {
+    for (size_t i = 0; i < parser->fields.size(); ++i) {
+        ast_expression *it = parser->fields[i];
         bool hasvalue;
+        if (i == parser->crc_fields)
+            ir->m_sys_fields = ir->m_fields.size();
         if (!ast_istype(it, ast_value))
             continue;
         ast_value *field = (ast_value*)it;
@@ -6261,6 +6267,8 @@ bool parser_finish(parser_t *parser, const char *output)
             (void)!field->m_ir_v->setField(ifld);
         }
     }
+    if (parser->crc_fields == parser->fields.size())
+        ir->m_sys_fields = ir->m_fields.size();
     for (auto &it : parser->globals) {
         ast_value *asvalue;
         if (!ast_istype(it, ast_value))
@@ -6355,13 +6363,27 @@ bool parser_finish(parser_t *parser, const char *output)
 
     if (OPTS_OPTION_BOOL(OPTION_DUMP))
         ir->dump(con_out);
-    for (auto &it : parser->functions) {
-        if (!ir_function_finalize(it->m_ir_func)) {
-            con_out("failed to finalize function %s\n", it->m_name.c_str());
-            delete ir;
-            return false;
+    if (OPTS_OPTIMIZATION(OPTIM_INLINE)) {
+        for (auto &it : parser->functions) {
+            if (!ir_function_inline(it->m_ir_func)) {
+                con_out("failed to inline calls in function %s\n", it->m_name.c_str());
+                delete ir;
+                return false;
+            }
         }
     }
+    std::vector<ir_function*> functions;
+    for (auto &it : parser->functions)
+        functions.push_back(it->m_ir_func);
+    if (!ir->finalize(functions)) {
+        delete ir;
+        return false;
+    }
+    /* after finalizing, so unreachable functions still get diagnosed and
+     * calls which were folded away do not count
+     */
+    if (OPTS_OPTIMIZATION(OPTIM_STRIP_FUNCTIONS))
+        ir->stripFunctions(functions);
     parser->remove_ast();
 
     auto fnCheckWErrors = [&retval]() {
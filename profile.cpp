@@ -0,0 +1,133 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "gmqcc.h"
+
+/*
+ * The counters qcvm -profile-out wrote for -fprofile-use.  Everything is
+ * keyed by function name and source position, see prog_write_profile in
+ * exec.cpp for the format.
+ */
+struct profile_branch_t {
+    uint64_t ontrue;
+    uint64_t onfalse;
+};
+
+struct profile_function_t {
+    uint64_t calls = 0;
+    std::unordered_map<uint64_t, uint64_t> lines;
+    std::unordered_map<uint64_t, profile_branch_t> branches;
+};
+
+static std::unordered_map<std::string, profile_function_t> profile_functions;
+
+static uint64_t profile_key(size_t line, size_t column) {
+    return ((uint64_t)line << 32) | (uint32_t)column;
+}
+
+bool profile_load(const char *filename) {
+    FILE   *fp = fopen(filename, "r");
+    char   *line = nullptr;
+    size_t  size = 0;
+    size_t  lineno = 0;
+    bool    ok = true;
+
+    if (!fp) {
+        con_err("failed to open profile `%s`\n", filename);
+        return false;
+    }
+
+    while (ok && util_getline(&line, &size, fp) != EOF) {
+        char *name;
+        char *kind = strtok(line, " \t\r\n");
+        char *args[4];
+        size_t i, argc;
+
+        ++lineno;
+        if (!kind || *kind == '#')
+            continue;
+        if (!(name = strtok(nullptr, " \t\r\n"))) {
+            ok = false;
+            break;
+        }
+        for (argc = 0; argc < GMQCC_ARRAY_COUNT(args); ++argc) {
+            if (!(args[argc] = strtok(nullptr, " \t\r\n")))
+                break;
+        }
+        if (argc == GMQCC_ARRAY_COUNT(args) && strtok(nullptr, " \t\r\n")) {
+            ok = false;
+            break;
+        }
+
+        /* counters are plain decimal numbers */
+        uint64_t values[4];
+        for (i = 0; ok && i < argc; ++i) {
+            char *end;
+            values[i] = strtoull(args[i], &end, 10);
+            ok = *args[i] >= '0' && *args[i] <= '9' && !*end;
+        }
+        if (!ok)
+            break;
+
+        profile_function_t &func = profile_functions[name];
+
+        if (!strcmp(kind, "function") && argc == 1)
+            func.calls += values[0];
+        else if (!strcmp(kind, "line") && argc == 2)
+            func.lines[values[0]] += values[1];
+        else if (!strcmp(kind, "branch") && argc == 4) {
+            profile_branch_t &b = func.branches[profile_key(values[0], values[1])];
+            b.ontrue  += values[2];
+            b.onfalse += values[3];
+        }
+        else
+            ok = false;
+    }
+
+    if (!ok)
+        con_err("%s:%lu: malformed profile entry\n", filename, (unsigned long)lineno);
+    else if (ferror(fp)) {
+        con_err("failed to read profile `%s`\n", filename);
+        ok = false;
+    }
+    mem_d(line);
+    fclose(fp);
+    return ok;
+}
+
+void profile_clear(void) {
+    profile_functions.clear();
+}
+
+static const profile_function_t *profile_function(const char *function) {
+    auto it = profile_functions.find(function);
+    return it == profile_functions.end() ? nullptr : &it->second;
+}
+
+bool profile_branch(const char *function, size_t line, size_t column, uint64_t *ontrue, uint64_t *onfalse) {
+    const profile_function_t *func = profile_function(function);
+    if (!func)
+        return false;
+    auto it = func->branches.find(profile_key(line, column));
+    if (it == func->branches.end())
+        return false;
+    *ontrue  = it->second.ontrue;
+    *onfalse = it->second.onfalse;
+    return true;
+}
+
+uint64_t profile_calls(const char *function) {
+    const profile_function_t *func = profile_function(function);
+    return func ? func->calls : 0;
+}
+
+uint64_t profile_line(const char *function, size_t line) {
+    const profile_function_t *func = profile_function(function);
+    if (!func)
+        return 0;
+    auto it = func->lines.find(line);
+    return it == func->lines.end() ? 0 : it->second;
+}
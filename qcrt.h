@@ -0,0 +1,140 @@
+#ifndef GMQCC_QCRT_HDR
+#define GMQCC_QCRT_HDR
+/*
+ * Runtime interface for the C code gmqcc emits with -emit-c.  The
+ * generated functions work on the globals and entities of the VM which
+ * hosts them, everything else (builtins, strings, errors) goes through
+ * the callbacks below.  This header is plain C so it can be compiled
+ * together with the generated code into the host or a shared object.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QCRT_VERSION 1
+
+/* must match QCVM_ENTITY_CHUNK_BITS of the host */
+#define QCRT_ENTITY_CHUNK_BITS 5
+#define QCRT_ENTITY_CHUNK      (1 << QCRT_ENTITY_CHUNK_BITS)
+
+#define QCRT_OFS_RETURN 1
+#define QCRT_OFS_PARM0  4
+
+typedef int32_t qcrt_int_t;
+typedef float   qcrt_float_t;
+
+typedef union {
+    qcrt_int_t   _int;
+    qcrt_float_t _float;
+    qcrt_float_t vector[3];
+    qcrt_int_t   ivector[3];
+} qcrt_any_t;
+
+typedef struct qcrt_s qcrt_t;
+
+/* returns non-zero when the VM raised an error */
+typedef int (*qcrt_function_t)(qcrt_t *rt);
+
+/*
+ * The host keeps chunks, entities and entityfields current whenever
+ * control passes into generated code, including after every call.
+ */
+struct qcrt_s {
+    qcrt_int_t   *globals;
+    qcrt_int_t  **chunks;
+    qcrt_int_t    entities;
+    qcrt_int_t    entityfields;
+    int           allowworldwrites;
+
+    /* calls builtins and functions through the function table */
+    int         (*call)(qcrt_t *rt, qcrt_int_t function, int argc);
+    const char *(*string)(qcrt_t *rt, qcrt_int_t str);
+    int         (*state)(qcrt_t *rt, qcrt_float_t frame, qcrt_int_t think);
+    void        (*error)(qcrt_t *rt, const char *fmt, ...);
+
+    void         *host;
+};
+
+typedef struct {
+    qcrt_int_t      function; /* index into the progs function table */
+    qcrt_function_t native;
+} qcrt_entry_t;
+
+/* what qcrt_module() of the generated code returns */
+typedef struct {
+    int                 version;
+    uint16_t            crc;
+    qcrt_int_t          globals;
+    qcrt_int_t          functions;
+    qcrt_int_t          statements;
+    const qcrt_entry_t *entries;
+    size_t              count;
+} qcrt_module_t;
+
+/* the generated code keeps the globals in a local named g */
+#define QCRT_G(o)    ((qcrt_any_t*)(g + (o)))
+#define QCRT_I(o)    (QCRT_G(o)->_int)
+#define QCRT_F(o)    (QCRT_G(o)->_float)
+#define QCRT_V(o, i) (QCRT_G(o)->vector[i])
+#define QCRT_TRUE(o) (QCRT_I(o) & 0x7FFFFFFF)
+
+static inline qcrt_int_t *qcrt_entity(qcrt_t *rt, qcrt_int_t e) {
+    return rt->chunks[e >> QCRT_ENTITY_CHUNK_BITS] +
+           (e & (QCRT_ENTITY_CHUNK - 1)) * rt->entityfields;
+}
+
+/* the n words at field f of entity e, or NULL after reporting an error */
+static inline qcrt_int_t *qcrt_field(qcrt_t *rt, qcrt_int_t e, qcrt_int_t f, int n) {
+    if (e < 0 || e >= rt->entities) {
+        rt->error(rt, "attempted to read an out of bounds entity %i", (int)e);
+        return NULL;
+    }
+    if (f < 0 || f + n > rt->entityfields) {
+        rt->error(rt, "attempted to read an invalid field from entity (%i)", (int)f);
+        return NULL;
+    }
+    return qcrt_entity(rt, e) + f;
+}
+
+/* the n words a field pointer made by ADDRESS points to */
+static inline qcrt_int_t *qcrt_pointer(qcrt_t *rt, qcrt_int_t p, int n) {
+    if (p < 0 || p >= rt->entities * rt->entityfields ||
+        p % rt->entityfields + n > rt->entityfields)
+    {
+        rt->error(rt, "attempted to write to an out of bounds edict (%i)", (int)p);
+        return NULL;
+    }
+    if (p < rt->entityfields && !rt->allowworldwrites) {
+        rt->error(rt, "tried to assign to world (field %i)", (int)p);
+        return NULL;
+    }
+    return qcrt_entity(rt, p / rt->entityfields) + p % rt->entityfields;
+}
+
+/*
+ * the n globals at float index i into the array at global o, whose element
+ * count is the float in front of it, count being the number of globals
+ */
+static inline qcrt_int_t *qcrt_index(qcrt_t *rt, qcrt_int_t o, qcrt_float_t i, int n, qcrt_int_t count) {
+    qcrt_float_t elements = (o > 0 && o < count) ? ((qcrt_any_t*)(rt->globals + o - 1))->_float : 0;
+    if (!(i >= 0) || i >= elements || i >= count || o + (qcrt_int_t)i * n + n > count) {
+        rt->error(rt, "accessed index %g of the %g element array at global %i", (double)i, (double)elements, (int)o);
+        return NULL;
+    }
+    return rt->globals + o + (qcrt_int_t)i * n;
+}
+
+static inline int qcrt_streq(qcrt_t *rt, qcrt_int_t a, qcrt_int_t b) {
+    return !strcmp(rt->string(rt, a), rt->string(rt, b));
+}
+
+const qcrt_module_t *qcrt_module(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -153,8 +153,9 @@ static int task_pclose(FILE **handles) {
  *          Used to set the compilation flags for the given task, this
  *          must be provided, this tag is NOT optional.
  *
- *      F:  Used to set some test suite flags, currently the only option
- *          is -no-defs (to including of defs.qh)
+ *      F:  Used to set some test suite flags, either -no-defs (to not
+ *          include defs.qh) or -profile (to compile against the profile
+ *          written by executing main without the E: flags first)
  *
  *      E:
  *          Used to set the execution flags for the given task. This tag
@@ -573,6 +574,35 @@ struct task_t {
 
 static std::vector<task_t> task_tasks;
 
+/*
+ * With -native executions go through the C backend: the compiler also
+ * writes the program as C, which gets built into a shared object and
+ * executed by the QCVM in place of the interpreter.
+ */
+static bool task_native = false;
+
+/*
+ * Trains a task with F: -profile: the compile command in buf is run with
+ * -flno, main is executed with -profile-out and buf gets the flag which
+ * makes the real compile use that profile.
+ */
+static bool task_profile(task_template_t *tmpl, char *buf, size_t size) {
+    char command[4096];
+
+    util_snprintf(command, sizeof(command), "%s -flno >/dev/null 2>&1", buf);
+    if (system(command))
+        return false;
+    util_snprintf(command, sizeof(command), "%s -profile-out %s.prof %s >/dev/null 2>&1",
+        task_bins[TASK_EXECUTE],
+        tmpl->tempfilename,
+        tmpl->tempfilename
+    );
+    if (system(command))
+        return false;
+    util_snprintf(buf + strlen(buf), size - strlen(buf), " -fprofile-use=%s.prof", tmpl->tempfilename);
+    return true;
+}
+
 /*
  * Read a directory and searches for all template files in it
  * which is later used to run all tests.
@@ -732,6 +762,15 @@ static bool task_propagate(const char *curdir, size_t *pad, const char *defs) {
                     }
                 }
 
+                if (tmpl->testflags && !strcmp(tmpl->testflags, "-profile") && !task_profile(tmpl, buf, sizeof(buf))) {
+                    con_err("error writing the profile for test: %s\n", tmpl->description);
+                    success = false;
+                    continue;
+                }
+
+                if (task_native && !strcmp(tmpl->proceduretype, "-execute"))
+                    util_snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), " -emit-c=%s.c", tmpl->tempfilename);
+
                 /*
                  * The task template was compiled, now lets create a task from
                  * the template data which has now been propagated.
@@ -821,6 +860,21 @@ static void task_destroy(void) {
                 con_err("error removing stderr log file: %s\n", it.stderrlogfile);
 
             (void)!remove(it.tmpl->tempfilename);
+            if (it.tmpl->testflags && !strcmp(it.tmpl->testflags, "-profile")) {
+                char buffer[4096];
+                util_snprintf(buffer, sizeof(buffer), "%s.prof", it.tmpl->tempfilename);
+                (void)!remove(buffer);
+                util_snprintf(buffer, sizeof(buffer), "%.*s.lno",
+                    (int)(strlen(it.tmpl->tempfilename) - 4), it.tmpl->tempfilename);
+                (void)!remove(buffer);
+            }
+            if (task_native && !strcmp(it.tmpl->proceduretype, "-execute")) {
+                char buffer[4096];
+                util_snprintf(buffer, sizeof(buffer), "%s.c", it.tmpl->tempfilename);
+                (void)!remove(buffer);
+                util_snprintf(buffer, sizeof(buffer), "%s.so", it.tmpl->tempfilename);
+                (void)!remove(buffer);
+            }
         }
 
         /* free util_strdup data for log files */
@@ -848,18 +902,35 @@ static bool task_trymatch(task_t &task, std::vector<char *> &line) {
     memset(buffer,0,sizeof(buffer));
 
     if (!strcmp(tmpl->proceduretype, "-execute")) {
+        char native[4096] = "";
+
+        if (task_native) {
+            const char *cc = getenv("CC");
+            util_snprintf(buffer, sizeof(buffer),
+                "%s -std=c99 -O2 -ffp-contract=off -fno-strict-aliasing -fPIC -shared -I. %s.c -o %s.so",
+                cc ? cc : "cc",
+                tmpl->tempfilename,
+                tmpl->tempfilename
+            );
+            if (system(buffer))
+                return false;
+            util_snprintf(native, sizeof(native), "-native %s.so", tmpl->tempfilename);
+        }
+
         /*
          * Drop the execution flags for the QCVM if none where
          * actually specified.
          */
         if (!strcmp(tmpl->executeflags, "$null")) {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s",
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
                 task_bins[TASK_EXECUTE],
+                native,
                 tmpl->tempfilename
             );
         } else {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s %s",
                 task_bins[TASK_EXECUTE],
+                native,
                 tmpl->executeflags,
                 tmpl->tempfilename
             );
@@ -1141,7 +1212,7 @@ static size_t task_schedualize(size_t *pad) {
             );
             for (; d < it.tmpl->comparematch.size(); d++) {
                 char *select = it.tmpl->comparematch[d];
-                size_t length = 60 - strlen(select);
+                size_t length = strlen(select) < 60 ? 60 - strlen(select) : 0;
                 con_out("        Expected: \"%s\"", select);
                 while (length --)
                     con_out(" ");
@@ -1294,6 +1365,10 @@ int main(int argc, char **argv) {
                 con_color(0);
                 continue;
             }
+            if (!strcmp(argv[0]+1, "native")) {
+                task_native = true;
+                continue;
+            }
 
             con_err("invalid argument %s\n", argv[0]+1);
             return -1;
@@ -19,7 +19,10 @@ const char *util_instr_str[VINSTR_END] = {
     "CALL1",      "CALL2",      "CALL3",      "CALL4",
     "CALL5",      "CALL6",      "CALL7",      "CALL8",
     "STATE",      "GOTO",       "AND",        "OR",
-    "BITAND",     "BITOR"
+    "BITAND",     "BITOR",      "BITAND_V",   "BITAND_VF",
+    "BITOR_V",    "BITOR_VF",   "BITXOR",     "BITXOR_V",
+    "BITXOR_VF",  "CROSS",      "LOADA_F",    "LOADA_V",
+    "STOREA_F",   "STOREA_V",   "TAILCALL"
 };
 
 /*